@@ -133,4 +133,16 @@ typedef enum {
 	MLZ_CACHELINE_ALIGN = 512
 } mlz_constants;
 
+/* source/destination buffer pair for mlz_compress_batch and */
+/* mlz_decompress_batch                                       */
+typedef struct
+{
+	MLZ_CONST void *src;
+	size_t          src_size;
+	void           *dst;
+	size_t          dst_size;
+	/* output: compressed/decompressed size, 0 on failure */
+	size_t          result;
+} mlz_buffer_desc;
+
 #endif
@@ -250,18 +250,117 @@ static MLZ_CONST mlz_sbyte mlz_offset_table[] = {0, -8, -8, -9, -8, -10, -12, -1
 	mlz_byte *db = (mlz_byte *)dst; \
 	MLZ_CONST mlz_byte *odb = db;
 
-size_t
-mlz_decompress(
-	void           *dst,
-	size_t          dst_size,
-	MLZ_CONST void *src,
-	size_t          src_size,
-	size_t          bytes_before_dst
+/* decode one literal, match or literal run (fast path: no need to */
+/* check for end of src); continue ends the token                 */
+#define MLZ_DEC_TOKEN_FAST() \
+	if ((accum & MLZ_DEC_6BIT_MASK)) { \
+		MLZ_GET_BIT_FAST_NOACCUM(bit0) \
+		MLZ_LITERAL_FAST() \
+ \
+		/* match... */ \
+		MLZ_GET_TYPE_FAST_NOACCUM(type) \
+		if (type == 0) { \
+			/* tiny match */ \
+			MLZ_GET_SHORT_LEN_FAST_NOACCUM(len) \
+			MLZ_TINY_MATCH() \
+			if (dist == 0) { \
+				/* literal run */ \
+				MLZ_LITERAL_RUN() \
+				continue; \
+			} \
+		} else if (type == 2) { \
+			/* short match */ \
+			MLZ_SHORT_MATCH() \
+		} else if (type == 1) { \
+			/* short2 match */ \
+			MLZ_GET_SHORT_LEN_FAST_NOACCUM(len) \
+			MLZ_SHORT2_MATCH() \
+		} else { \
+			/* full match */ \
+			MLZ_FULL_MATCH() \
+		} \
+		/* copy match */ \
+		MLZ_COPY_MATCH() \
+		continue; \
+	} \
+ \
+	MLZ_GET_BIT_FAST(bit0) \
+	MLZ_LITERAL_FAST() \
+ \
+	/* match... */ \
+	MLZ_GET_TYPE_FAST(type) \
+	if (type == 0) { \
+		/* tiny match */ \
+		MLZ_GET_SHORT_LEN_FAST(len) \
+		MLZ_TINY_MATCH() \
+		if (dist == 0) { \
+			/* literal run */ \
+			MLZ_LITERAL_RUN() \
+			continue; \
+		} \
+	} else if (type == 2) { \
+		/* short match */ \
+		MLZ_SHORT_MATCH() \
+	} else if (type == 1) { \
+		/* short2 match */ \
+		MLZ_GET_SHORT_LEN_FAST(len) \
+		MLZ_SHORT2_MATCH() \
+	} else { \
+		/* full match */ \
+		MLZ_FULL_MATCH() \
+	} \
+	/* copy match */ \
+	MLZ_COPY_MATCH()
+
+/* as above, checking for end of src */
+#define MLZ_DEC_TOKEN() \
+	MLZ_GET_BIT(bit0) \
+	MLZ_LITERAL() \
+ \
+	/* match... */ \
+	MLZ_GET_TYPE(type) \
+	if (type == 0) { \
+		/* tiny match */ \
+		MLZ_GET_SHORT_LEN(len) \
+		MLZ_TINY_MATCH_SAFE() \
+		if (dist == 0) { \
+			/* literal run */ \
+			MLZ_LITERAL_RUN_SAFE() \
+			continue; \
+		} \
+	} else if (type == 2) { \
+		/* short match */ \
+		MLZ_SHORT_MATCH_SAFE() \
+	} else if (type == 1) { \
+		/* short2 match */ \
+		MLZ_GET_SHORT_LEN(len) \
+		MLZ_SHORT2_MATCH_SAFE() \
+	} else { \
+		/* full match */ \
+		MLZ_FULL_MATCH_SAFE() \
+	} \
+	/* copy match */ \
+	MLZ_COPY_MATCH()
+
+/* fast path if we know we don't have to check for anything */
+/* max data to read: 5 bytes + 2 accum reserve               */
+#define MLZ_DEC_FAST_LIMIT(se) ((se) - (5 + 2*MLZ_ACCUM_BYTES))
+
+/* decode from sb (accum loaded) to end of src, returns decompressed */
+/* size (from odb) or 0 on error                                     */
+static size_t
+mlz_decompress_tokens(
+	MLZ_CONST mlz_byte *sb,
+	MLZ_CONST mlz_byte *se,
+	mlz_uint            accum,
+	mlz_byte           *db,
+	MLZ_CONST mlz_byte *de,
+	MLZ_CONST mlz_byte *odb,
+	MLZ_CONST mlz_byte *odblimit
 )
 {
-	MLZ_INIT_DECOMPRESS()
-	MLZ_CONST mlz_byte *de = db + dst_size;
-	MLZ_CONST mlz_byte *odblimit = odb - bytes_before_dst;
+	mlz_int chlen;
+	int bit0, type;
 	mlz_int dist = 0, len = 0;
 	(void)dist;
 	(void)len;
@@ -277,106 +376,134 @@ mlz_decompress(
 	            len above MIN_MATCH + 1 is illegal)
 	*/
 
+	while (sb < MLZ_DEC_FAST_LIMIT(se)) {
+		MLZ_DEC_TOKEN_FAST()
+	}
+
+	while (sb < se) {
+		MLZ_DEC_TOKEN()
+	}
+
+	/* using strict condition (full source buffer decoded) */
+	return sb == se ? (size_t)(db - odb) : 0;
+}
+
+size_t
+mlz_decompress(
+	void           *dst,
+	size_t          dst_size,
+	MLZ_CONST void *src,
+	size_t          src_size,
+	size_t          bytes_before_dst
+)
+{
+	mlz_uint            accum;
+	MLZ_CONST mlz_byte *sb = (MLZ_CONST mlz_byte *)src;
+	MLZ_CONST mlz_byte *se = sb + src_size;
+	mlz_byte           *db = (mlz_byte *)dst;
+
 	MLZ_RET_FALSE(sb + MLZ_ACCUM_BYTES <= se);
 
 	MLZ_LOAD_ACCUM()
 
-	/* fast path if we know we don't have to check for anything */
-	/* max data to read: 5 bytes + 2 accum reserve */
+	return mlz_decompress_tokens(sb, se, accum, db, db + dst_size, db, db - bytes_before_dst);
+}
 
-	while (sb < se - (5 + 2*MLZ_ACCUM_BYTES)) {
-		if ((accum & MLZ_DEC_6BIT_MASK)) {
-			MLZ_GET_BIT_FAST_NOACCUM(bit0)
-			MLZ_LITERAL_FAST()
+/* copy state of item n to/from working variables of mlz_decompress_pair */
+#define MLZ_DEC_LANE_LOAD(n) \
+	sb = sb##n; \
+	se = se##n; \
+	db = db##n; \
+	de = de##n; \
+	odblimit = odb##n; \
+	accum = accum##n;
+
+#define MLZ_DEC_LANE_STORE(n) \
+	sb##n = sb; \
+	db##n = db; \
+	accum##n = accum;
+
+/* decode two items interleaved, one token each in turn, while both */
+/* are in fast path, then finish them one by one; all state stays   */
+/* in locals so that it can be kept in registers                    */
+/* returns MLZ_FALSE on error (item results not valid then)         */
+static mlz_bool mlz_decompress_pair(mlz_buffer_desc *x, mlz_buffer_desc *y)
+{
+	mlz_uint            accum, accum0, accum1;
+	mlz_int             chlen, dist = 0, len = 0;
+	int                 bit0, type;
+	MLZ_CONST mlz_byte *sb, *se, *de, *odblimit;
+	mlz_byte           *db;
+	MLZ_CONST mlz_byte *sb0  = (MLZ_CONST mlz_byte *)x->src;
+	MLZ_CONST mlz_byte *se0  = sb0 + x->src_size;
+	mlz_byte           *db0  = (mlz_byte *)x->dst;
+	MLZ_CONST mlz_byte *de0  = db0 + x->dst_size;
+	MLZ_CONST mlz_byte *odb0 = db0;
+	MLZ_CONST mlz_byte *sb1  = (MLZ_CONST mlz_byte *)y->src;
+	MLZ_CONST mlz_byte *se1  = sb1 + y->src_size;
+	mlz_byte           *db1  = (mlz_byte *)y->dst;
+	MLZ_CONST mlz_byte *de1  = db1 + y->dst_size;
+	MLZ_CONST mlz_byte *odb1 = db1;
+
+	MLZ_RET_FALSE(sb0 + MLZ_ACCUM_BYTES <= se0 && sb1 + MLZ_ACCUM_BYTES <= se1);
+
+	sb = sb0;
+	MLZ_LOAD_ACCUM()
+	sb0    = sb;
+	accum0 = accum;
 
-			/* match... */
-			MLZ_GET_TYPE_FAST_NOACCUM(type)
-			if (type == 0) {
-				/* tiny match */
-				MLZ_GET_SHORT_LEN_FAST_NOACCUM(len)
-				MLZ_TINY_MATCH()
-				if (dist == 0) {
-					/* literal run */
-					MLZ_LITERAL_RUN()
-					continue;
-				}
-			} else if (type == 2) {
-				/* short match */
-				MLZ_SHORT_MATCH()
-			} else if (type == 1) {
-				/* short2 match */
-				MLZ_GET_SHORT_LEN_FAST_NOACCUM(len)
-				MLZ_SHORT2_MATCH()
-			} else {
-				/* full match */
-				MLZ_FULL_MATCH()
-			}
-			/* copy match */
-			MLZ_COPY_MATCH()
-			continue;
-		}
+	sb = sb1;
+	MLZ_LOAD_ACCUM()
+	sb1    = sb;
+	accum1 = accum;
+
+	while (sb0 < MLZ_DEC_FAST_LIMIT(se0) && sb1 < MLZ_DEC_FAST_LIMIT(se1)) {
+		/* do-while: continue in token ends the token */
+		MLZ_DEC_LANE_LOAD(0)
+		do {
+			MLZ_DEC_TOKEN_FAST()
+		} while (0);
+		MLZ_DEC_LANE_STORE(0)
+
+		MLZ_DEC_LANE_LOAD(1)
+		do {
+			MLZ_DEC_TOKEN_FAST()
+		} while (0);
+		MLZ_DEC_LANE_STORE(1)
+	}
 
-		MLZ_GET_BIT_FAST(bit0)
-		MLZ_LITERAL_FAST()
+	x->result = mlz_decompress_tokens(sb0, se0, accum0, db0, de0, odb0, odb0);
+	y->result = mlz_decompress_tokens(sb1, se1, accum1, db1, de1, odb1, odb1);
+	return x->result && y->result;
+}
 
-		/* match... */
-		MLZ_GET_TYPE_FAST(type)
-		if (type == 0) {
-			/* tiny match */
-			MLZ_GET_SHORT_LEN_FAST(len)
-			MLZ_TINY_MATCH()
-			if (dist == 0) {
-				/* literal run */
-				MLZ_LITERAL_RUN()
-				continue;
-			}
-		} else if (type == 2) {
-			/* short match */
-			MLZ_SHORT_MATCH()
-		} else if (type == 1) {
-			/* short2 match */
-			MLZ_GET_SHORT_LEN_FAST(len)
-			MLZ_SHORT2_MATCH()
-		} else {
-			/* full match */
-			MLZ_FULL_MATCH()
-		}
-		/* copy match */
-		MLZ_COPY_MATCH()
-	}
+mlz_bool
+mlz_decompress_batch(
+	mlz_buffer_desc *items,
+	size_t           count
+)
+{
+	size_t   i;
+	mlz_bool res = MLZ_TRUE;
 
-	while (sb < se) {
-		MLZ_GET_BIT(bit0)
-		MLZ_LITERAL()
+	MLZ_RET_FALSE(items || !count);
 
-		/* match... */
-		MLZ_GET_TYPE(type)
-		if (type == 0) {
-			/* tiny match */
-			MLZ_GET_SHORT_LEN(len)
-			MLZ_TINY_MATCH_SAFE()
-			if (dist == 0) {
-				/* literal run */
-				MLZ_LITERAL_RUN_SAFE()
-				continue;
-			}
-		} else if (type == 2) {
-			/* short match */
-			MLZ_SHORT_MATCH_SAFE()
-		} else if (type == 1) {
-			/* short2 match */
-			MLZ_GET_SHORT_LEN(len)
-			MLZ_SHORT2_MATCH_SAFE()
-		} else {
-			/* full match */
-			MLZ_FULL_MATCH_SAFE()
+	for (i=0; i<count; i++) {
+		mlz_buffer_desc *item = items + i;
+
+		if (i+1 < count && mlz_decompress_pair(item, item+1)) {
+			i++;
+			continue;
 		}
-		/* copy match */
-		MLZ_COPY_MATCH()
+
+		/* last item or error: decode alone (exact result, next item */
+		/* is paired again)                                          */
+		item->result = mlz_decompress(item->dst, item->dst_size, item->src, item->src_size, 0);
+		if (!item->result)
+			res = MLZ_FALSE;
 	}
 
-	/* using strict condition (full source buffer decoded) */
-	return sb == se ? (size_t)(db - odb) : 0;
+	return res;
 }
 
 size_t
@@ -503,3 +630,8 @@ mlz_decompress_unsafe(
 #undef MLZ_LITERAL
 #undef MLZ_LITERAL_FAST
 #undef MLZ_INIT_DECOMPRESS
+#undef MLZ_DEC_TOKEN_FAST
+#undef MLZ_DEC_TOKEN
+#undef MLZ_DEC_FAST_LIMIT
+#undef MLZ_DEC_LANE_LOAD
+#undef MLZ_DEC_LANE_STORE
@@ -36,6 +36,9 @@
 extern "C" {
 #endif
 
+struct mlz_jobs;
+struct mlz_allocator;
+
 /* safe decompression */
 MLZ_API size_t
 mlz_decompress(
@@ -63,6 +66,54 @@ mlz_decompress_unsafe(
 	size_t          src_size
 );
 
+/* decompress many small independent buffers (as mlz_decompress    */
+/* without bytes_before_dst); pairs of items are decoded            */
+/* interleaved, one token each in turn, so that the CPU can overlap */
+/* their otherwise serial bit reader dependency chains (gain        */
+/* depends on CPU, results are the same as of mlz_decompress)       */
+/* item results are set; returns MLZ_TRUE if all items succeeded    */
+MLZ_API mlz_bool
+mlz_decompress_batch(
+	mlz_buffer_desc *items,
+	size_t           count
+);
+
+/* segmented parallel decompression (needs mlz_stream_dec.c, jobs need */
+/* MLZ_THREADS and mlz_thread.c)                                        */
+
+/* uncompressed size of segmented raw container (mlz_compress_parallel) */
+/* returns -1 if src isn't one                                           */
+MLZ_API mlz_intptr
+mlz_decompress_parallel_size(
+	MLZ_CONST void *src,
+	size_t          src_size
+);
+
+/* decode segmented raw container straight to dst, verifying checksum;  */
+/* independent segments (context size 0) are decoded in parallel using  */
+/* jobs (null = this thread only), segments seeded with context depend  */
+/* on previous ones so they are decoded serially (checksum in parallel) */
+/* returns decompressed size or -1 on error                             */
+MLZ_API mlz_intptr
+mlz_decompress_parallel(
+	void            *dst,
+	size_t           dst_size,
+	MLZ_CONST void  *src,
+	size_t           src_size,
+	struct mlz_jobs *jobs
+);
+
+/* as above, segment tables are allocated using allocator (null = mlz_malloc) */
+MLZ_API mlz_intptr
+mlz_decompress_parallel_ex(
+	void                           *dst,
+	size_t                          dst_size,
+	MLZ_CONST void                 *src,
+	size_t                          src_size,
+	struct mlz_jobs                *jobs,
+	MLZ_CONST struct mlz_allocator *allocator
+);
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,22 @@
 #include <string.h>
 #include <limits.h>
 
+#if defined(_WIN32)
+#	if !defined(WIN32_LEAN_AND_MEAN)
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	include <windows.h>
+#	define MLZ_HUGE_PAGES 1
+#elif defined(__unix__) || defined(__APPLE__)
+#	include <sys/mman.h>
+#	if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#		define MAP_ANON MAP_ANONYMOUS
+#	endif
+#	if defined(MAP_ANON)
+#		define MLZ_HUGE_PAGES 1
+#	endif
+#endif
+
 enum mlz_match_constants
 {
 	/* because we don't clear hash list, setting this too high will actually slow things down */
@@ -58,6 +74,129 @@ MLZ_INLINE void mlz_free_wrapper(void *ptr)
 void *(*mlz_malloc)(size_t) = mlz_malloc_wrapper;
 void (*mlz_free)(void *)    = mlz_free_wrapper;
 
+void *mlz_alloc(MLZ_CONST mlz_allocator *allocator, size_t size)
+{
+	return allocator ? allocator->alloc(allocator->user, size) : mlz_malloc(size);
+}
+
+void mlz_dealloc(MLZ_CONST mlz_allocator *allocator, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	if (allocator)
+		allocator->free(allocator->user, ptr);
+	else
+		mlz_free(ptr);
+}
+
+enum mlz_huge_page_constants
+{
+	MLZ_HUGE_PAGE_SIZE      = 2*1024*1024,
+	/* smaller blocks aren't worth rounding up to huge pages; */
+	/* matchers (~137k) and stream buffers are above this     */
+	MLZ_HUGE_PAGE_THRESHOLD = MLZ_HUGE_PAGE_SIZE/16
+};
+
+/* stored right before each block; size = 0: block comes from mlz_malloc */
+typedef struct
+{
+	void   *base;
+	size_t  size;
+} mlz_huge_header;
+
+static void *mlz_huge_page_alloc(void *user, size_t size)
+{
+	mlz_byte        *base;
+	mlz_huge_header *hdr;
+	size_t           total;
+
+	(void)user;
+
+#if defined(MLZ_HUGE_PAGES)
+	if (size >= MLZ_HUGE_PAGE_THRESHOLD && size < ((size_t)-1)/2) {
+		/* block keeps cacheline alignment */
+		total = (size + MLZ_CACHELINE_ALIGN + MLZ_HUGE_PAGE_SIZE-1) & ~((size_t)MLZ_HUGE_PAGE_SIZE-1);
+
+#	if defined(_WIN32)
+		{
+			SIZE_T large = GetLargePageMinimum();
+
+			base = MLZ_NULL;
+			/* large pages need SeLockMemoryPrivilege */
+			if (large && !(total & (large-1)))
+				base = (mlz_byte *)VirtualAlloc(MLZ_NULL, total, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+					PAGE_READWRITE);
+			if (!base)
+				base = (mlz_byte *)VirtualAlloc(MLZ_NULL, total, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		}
+#	else
+		{
+			/* over-allocate to get huge page aligned range */
+			mlz_byte *map = (mlz_byte *)mmap(MLZ_NULL, total + MLZ_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANON, -1, 0);
+			size_t    head;
+
+			if (map == (mlz_byte *)MAP_FAILED)
+				return MLZ_NULL;
+
+			head = (size_t)(((mlz_uintptr)MLZ_HUGE_PAGE_SIZE - ((mlz_uintptr)map & (MLZ_HUGE_PAGE_SIZE-1))) &
+				(MLZ_HUGE_PAGE_SIZE-1));
+			if (head)
+				(void)munmap(map, head);
+			(void)munmap(map + head + total, MLZ_HUGE_PAGE_SIZE - head);
+			base = map + head;
+#		if defined(MADV_HUGEPAGE)
+			(void)madvise(base, total, MADV_HUGEPAGE);
+#		endif
+		}
+#	endif
+
+		if (!base)
+			return MLZ_NULL;
+
+		hdr = (mlz_huge_header *)(base + MLZ_CACHELINE_ALIGN) - 1;
+		hdr->base = base;
+		hdr->size = total;
+		return base + MLZ_CACHELINE_ALIGN;
+	}
+#endif
+
+	total = size + sizeof(mlz_huge_header);
+	MLZ_RET_FALSE(total > size);
+	base = (mlz_byte *)mlz_malloc(total);
+	MLZ_RET_FALSE(base);
+
+	hdr = (mlz_huge_header *)base;
+	hdr->base = base;
+	hdr->size = 0;
+	return hdr + 1;
+}
+
+static void mlz_huge_page_free(void *user, void *ptr)
+{
+	mlz_huge_header *hdr = (mlz_huge_header *)ptr - 1;
+
+	(void)user;
+
+	if (!hdr->size) {
+		mlz_free(hdr->base);
+		return;
+	}
+
+#if defined(_WIN32)
+	(void)VirtualFree(hdr->base, 0, MEM_RELEASE);
+#elif defined(MLZ_HUGE_PAGES)
+	(void)munmap(hdr->base, hdr->size);
+#endif
+}
+
+MLZ_CONST mlz_allocator mlz_huge_page_allocator = {
+	mlz_huge_page_alloc,
+	mlz_huge_page_free,
+	MLZ_NULL
+};
+
 /* experimental naive, SLOW optimal parsing */
 typedef struct
 {
@@ -75,6 +214,10 @@ struct mlz_matcher
 	mlz_ushort list[MLZ_HASH_LIST_SIZE];
 	mlz_optimal *optimal;
 	size_t     optimal_size;
+	MLZ_CONST mlz_allocator *allocator;
+	/* added to positions (batch compression: hash entries of previous */
+	/* buffers end up before current one, so they're out of range)     */
+	mlz_ushort base;
 	mlz_byte   pad [MLZ_CACHELINE_ALIGN];
 };
 
@@ -86,34 +229,42 @@ mlz_bool mlz_matcher_alloc_opt(struct mlz_matcher *matcher, size_t size)
 		return MLZ_TRUE;
 
 	if (matcher->optimal)
-		mlz_free(matcher->optimal);
+		mlz_dealloc(matcher->allocator, matcher->optimal);
 
-	matcher->optimal = (mlz_optimal *)mlz_malloc(size*sizeof(mlz_optimal));
+	matcher->optimal = (mlz_optimal *)mlz_alloc(matcher->allocator, size*sizeof(mlz_optimal));
 	matcher->optimal_size = matcher->optimal ? size : 0;
 
 	return matcher->optimal != MLZ_NULL;
 }
 
-mlz_bool mlz_matcher_init(struct mlz_matcher **matcher)
+mlz_bool mlz_matcher_init_ex(struct mlz_matcher **matcher, MLZ_CONST mlz_allocator *allocator)
 {
 	if (!matcher)
 		return MLZ_FALSE;
 
-	*matcher = (struct mlz_matcher *)mlz_malloc(sizeof(struct mlz_matcher));
+	*matcher = (struct mlz_matcher *)mlz_alloc(allocator, sizeof(struct mlz_matcher));
 
 	if (*matcher) {
 		(*matcher)->optimal = MLZ_NULL;
 		(*matcher)->optimal_size = 0;
+		(*matcher)->allocator = allocator;
+		(*matcher)->base = 0;
 	}
 
 	return *matcher != MLZ_NULL;
 }
 
+mlz_bool mlz_matcher_init(struct mlz_matcher **matcher)
+{
+	return mlz_matcher_init_ex(matcher, MLZ_NULL);
+}
+
 static mlz_bool mlz_matcher_clear(struct mlz_matcher *matcher)
 {
 	MLZ_RET_FALSE(matcher != MLZ_NULL);
 	memset(matcher->hash, 0, sizeof(matcher->hash));
 	matcher->list[0] = 0;
+	matcher->base    = 0;
 	return MLZ_TRUE;
 }
 
@@ -121,9 +272,9 @@ mlz_bool mlz_matcher_free(struct mlz_matcher *matcher)
 {
 	if (matcher) {
 		if (matcher->optimal)
-			mlz_free(matcher->optimal);
+			mlz_dealloc(matcher->allocator, matcher->optimal);
 
-		mlz_free(matcher);
+		mlz_dealloc(matcher->allocator, matcher);
 	}
 
 	return matcher ? MLZ_TRUE : MLZ_FALSE;
@@ -242,7 +393,7 @@ MLZ_INLINE mlz_int mlz_clamp(mlz_int x, mlz_int y, mlz_int z)
 	MLZ_RET_FALSE(best_len && max_len > 0 && *best_len < max_len); \
  \
 	pos = m->hash[hash]; \
-	cyc_dist = (mlz_int)(mlz_ushort)opos - (mlz_ushort)pos; \
+	cyc_dist = (mlz_int)(mlz_ushort)(opos + m->base) - (mlz_ushort)pos; \
 	if (cyc_dist < 0) \
 		cyc_dist += MLZ_DICT_MASK+1; \
  \
@@ -337,6 +488,7 @@ MLZ_INLINE void mlz_match_hash_next_byte(struct mlz_matcher *m, mlz_uint hash, s
 
 	MLZ_ASSERT(m && hash <= MLZ_HASH_MASK);
 
+	pos += m->base;
 	idx = m->hash + hash;
 	m->list[pos & MLZ_DICT_MASK] = *idx;
 	*idx = (mlz_ushort)(pos & MLZ_DICT_MASK);
@@ -501,15 +653,17 @@ mlz_compress_optimal(
 	int                 level
 );
 
-size_t
-mlz_compress(
+/* clear = MLZ_FALSE: keep matcher as is (batch compression) */
+static size_t
+mlz_compress_matcher(
 	struct mlz_matcher *matcher,
 	void               *dst,
 	size_t              dst_size,
 	MLZ_CONST void     *src,
 	size_t              src_size,
 	size_t              bytes_before_src,
-	int                 level
+	int                 level,
+	mlz_bool            clear
 )
 {
 	mlz_accumulator accum;
@@ -531,7 +685,7 @@ mlz_compress(
 	if (level >= MLZ_LEVEL_OPTIMAL)
 		return mlz_compress_optimal(matcher, dst, dst_size, src, src_size, bytes_before_src, level);
 
-	MLZ_RET_FALSE(mlz_matcher_clear(matcher) && dst && src);
+	MLZ_RET_FALSE(matcher && dst && src && (!clear || mlz_matcher_clear(matcher)));
 
 	/* cannot handle blocks larger than 2G - 64k - 1 */
 	MLZ_RET_FALSE(se - osb < INT_MAX);
@@ -668,6 +822,57 @@ mlz_compress(
 	return (size_t)(db - odb);
 }
 
+size_t
+mlz_compress(
+	struct mlz_matcher *matcher,
+	void               *dst,
+	size_t              dst_size,
+	MLZ_CONST void     *src,
+	size_t              src_size,
+	size_t              bytes_before_src,
+	int                 level
+)
+{
+	return mlz_compress_matcher(matcher, dst, dst_size, src, src_size, bytes_before_src, level, MLZ_TRUE);
+}
+
+mlz_bool
+mlz_compress_batch(
+	struct mlz_matcher *matcher,
+	mlz_buffer_desc    *items,
+	size_t              count,
+	int                 level
+)
+{
+	size_t   i;
+	/* matcher positions used so far */
+	size_t   used = MLZ_DICT_MASK+1;
+	mlz_bool res  = MLZ_TRUE;
+
+	MLZ_RET_FALSE(matcher && (items || !count));
+
+	for (i=0; i<count; i++) {
+		mlz_buffer_desc *item = items + i;
+
+		/* matcher is only cleared once per 64k of input; */
+		/* each buffer gets fresh range of positions        */
+		if (used + item->src_size > MLZ_DICT_MASK+1) {
+			MLZ_RET_FALSE(mlz_matcher_clear(matcher));
+			used = 0;
+		}
+
+		matcher->base = (mlz_ushort)used;
+		item->result  = mlz_compress_matcher(matcher, item->dst, item->dst_size,
+			item->src, item->src_size, 0, level, MLZ_FALSE);
+
+		/* optimal parsing clears matcher */
+		used = level >= MLZ_LEVEL_OPTIMAL ? MLZ_DICT_MASK+1 : used + item->src_size;
+		res  = res && (item->result || !item->src_size);
+	}
+
+	return res;
+}
+
 size_t
 mlz_compress_simple(
 	void               *dst,
@@ -39,7 +39,38 @@ extern "C" {
 extern MLZ_API void *(*mlz_malloc)(size_t);
 extern MLZ_API void (*mlz_free)(void *);
 
+/* allocator with user data, can be passed to matchers, streams and jobs */
+/* MLZ_NULL allocator means mlz_malloc/mlz_free                          */
+typedef struct mlz_allocator
+{
+	/* returns MLZ_NULL on failure */
+	void *(*alloc)(void *user, size_t size);
+	void  (*free)(void *user, void *ptr);
+	void  *user;
+} mlz_allocator;
+
+/* built-in allocator placing large blocks (128k+, e.g. matchers and  */
+/* stream buffers) in huge pages:                                      */
+/* transparent huge pages (madvise) on Linux, large pages on Windows   */
+/* (if allowed); smaller blocks and other platforms use mlz_malloc     */
+extern MLZ_API MLZ_CONST mlz_allocator mlz_huge_page_allocator;
+
+/* allocate using allocator (MLZ_NULL = mlz_malloc) */
+MLZ_API void *
+mlz_alloc(
+	MLZ_CONST mlz_allocator *allocator,
+	size_t                   size
+);
+
+/* free using allocator (MLZ_NULL = mlz_free), ptr may be MLZ_NULL */
+MLZ_API void
+mlz_dealloc(
+	MLZ_CONST mlz_allocator *allocator,
+	void                    *ptr
+);
+
 struct mlz_matcher;
+struct mlz_jobs;
 
 /* compression level constants */
 typedef enum {
@@ -56,6 +87,13 @@ mlz_matcher_init(
 	struct mlz_matcher **matcher
 );
 
+/* initialize matcher using allocator (MLZ_NULL = mlz_malloc) */
+MLZ_API mlz_bool
+mlz_matcher_init_ex(
+	struct mlz_matcher     **matcher,
+	MLZ_CONST mlz_allocator *allocator
+);
+
 /* free matcher */
 MLZ_API mlz_bool
 mlz_matcher_free(
@@ -75,6 +113,18 @@ mlz_compress(
 	int                 level
 );
 
+/* compress many small buffers back to back, each independently  */
+/* (as mlz_compress without bytes_before_src); matcher is cleared  */
+/* only once per 64k of input instead of for every buffer           */
+/* item results are set; returns MLZ_TRUE if all items succeeded    */
+MLZ_API mlz_bool
+mlz_compress_batch(
+	struct mlz_matcher *matcher,
+	mlz_buffer_desc    *items,
+	size_t              count,
+	int                 level
+);
+
 /* straightforward version, manages matcher internally, */
 /* doesn't allow streaming                              */
 MLZ_API size_t
@@ -86,6 +136,48 @@ mlz_compress_simple(
 	int             level
 );
 
+/* segmented parallel compression (needs mlz_stream_enc.c, jobs need */
+/* MLZ_THREADS and mlz_thread.c)                                      */
+
+/* dst size needed by mlz_compress_parallel */
+MLZ_API size_t
+mlz_compress_parallel_bound(
+	size_t src_size
+);
+
+/* compress src (up to 4G) to segmented raw container (see             */
+/* MLZ_SEGMENTED_MAGIC); independent segments are compressed in        */
+/* parallel using jobs (null = this thread only), so that               */
+/* mlz_decompress_parallel can decode them in parallel too              */
+/* dst_size must be at least mlz_compress_parallel_bound(src_size)      */
+/* returns compressed size or 0 on failure                              */
+MLZ_API size_t
+mlz_compress_parallel(
+	void            *dst,
+	size_t           dst_size,
+	MLZ_CONST void  *src,
+	size_t           src_size,
+	int              level,
+	struct mlz_jobs *jobs
+);
+
+/* as above with context size up to MLZ_BLOCK_CONTEXT_SIZE: segments  */
+/* seeded with that many preceding bytes compress slightly better,    */
+/* but depend on previous ones, so mlz_decompress_parallel decodes    */
+/* them serially (only checksums are verified in parallel); allocator */
+/* is used for matchers and segment tables (null = mlz_malloc)        */
+MLZ_API size_t
+mlz_compress_parallel_ex(
+	void                    *dst,
+	size_t                   dst_size,
+	MLZ_CONST void          *src,
+	size_t                   src_size,
+	int                      level,
+	struct mlz_jobs         *jobs,
+	size_t                   context_size,
+	MLZ_CONST mlz_allocator *allocator
+);
+
 #ifdef __cplusplus
 }
 #endif
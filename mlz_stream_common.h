@@ -37,6 +37,7 @@ extern "C" {
 #endif
 
 struct mlz_jobs;
+struct mlz_allocator;
 
 typedef struct {
 	/* user data (handle) */
@@ -75,8 +76,71 @@ typedef struct {
 	mlz_bool     unsafe;
 	/* use simple stream header to identify block params automatically */
 	mlz_bool     use_header;
+	/* out stream only: compress batches in background (jobs only),  */
+	/* overlapping input, compression and output; uses twice the RAM */
+	mlz_bool     pipelined;
+	/* out stream only, dependent blocks: reset context every n blocks */
+	/* (sync point); allows multi-threaded decompression of groups    */
+	/* of n blocks at a small ratio loss; 0 = never                   */
+	mlz_int      sync_interval;
+	/* out stream only: append block index on close, allows fast seeking */
+	mlz_bool     use_index;
+	/* optional seek callback, in stream only; seeks to absolute offset,   */
+	/* negative offset is relative to end; returns MLZ_TRUE on success;    */
+	/* block index only seeks relative to end (index trailer ends input)   */
+	mlz_bool   (*seek_func)(void *handle, mlz_long offset);
+	/* optional: combines incremental checksum prev with checksum next of  */
+	/* following next_size bytes (computed from initial_checksum); allows  */
+	/* computing incremental checksum in parallel; must match incremental  */
+	/* checksum function, null = checksum serially; ignored for known      */
+	/* checksum functions (see mlz_get_checksum_info), which imply it     */
+	mlz_uint   (*combine_checksum)(mlz_uint prev, mlz_uint next, size_t next_size);
+	/* 64-bit compressed block checksum function, stored as LE64;  */
+	/* used instead of block_checksum if set (null = off)          */
+	mlz_ulong  (*block_checksum64)(MLZ_CONST void *buf, size_t size);
+	/* out stream only: total uncompressed size if known in advance, */
+	/* 0 = unknown; stored in (extended) header, verified on close   */
+	mlz_long     content_size;
+	/* in stream only: read-ahead buffer size, 0 = off; block headers and  */
+	/* small blocks are served from one read_func call per buffer refill  */
+	/* note: may read past end of stream, 65536 is recommended if stream */
+	/* isn't followed by other data read through the same handle         */
+	mlz_int      read_ahead;
+	/* in stream only (needs MLZ_THREADS and read_ahead): read next batch */
+	/* of compressed blocks (read-ahead buffer grows to batch size) in    */
+	/* background thread while current one is being decoded; read_func    */
+	/* is then called from that thread (one call at a time)               */
+	mlz_bool     async_read;
+	/* out stream only: adaptive block size, 0 = off; blocks vary between */
+	/* min_block_size and block_size (power of two): flush of a partly     */
+	/* filled batch shrinks them; after full batches they double only      */
+	/* while measured compression ratio improves (by 1/128), otherwise     */
+	/* smaller blocks are kept for latency; smaller blocks are stored as   */
+	/* partial blocks                                                      */
+	mlz_int      min_block_size;
+	/* in stream only (needs stream header): continue decoding concatenated */
+	/* streams (frames), skipping their block index; input must end after   */
+	/* last frame; seeking uses index only if input is a single frame       */
+	mlz_bool     multi_frame;
+	/* allocator for stream memory (see mlz_enc.h), null = mlz_malloc; */
+	/* must stay valid until stream is closed, can't change on reset   */
+	MLZ_CONST struct mlz_allocator *allocator;
 } mlz_stream_params;
 
+/* checksum algorithm; stream header stores types of known checksum */
+/* functions (see mlz_get_checksum_info); with stream header, the    */
+/* out stream uses matching combine function and initial value       */
+typedef struct {
+	/* block checksum function */
+	mlz_uint   (*block_checksum)(MLZ_CONST void *buf, size_t size);
+	/* incremental checksum function or null if not supported */
+	mlz_uint   (*incremental_checksum)(MLZ_CONST void *buf, size_t size, mlz_uint prev);
+	mlz_uint   (*combine_checksum)(mlz_uint prev, mlz_uint next, size_t next_size);
+	mlz_uint     initial_checksum;
+	/* 64-bit block checksum function (instead of block_checksum) */
+	mlz_ulong  (*block_checksum64)(MLZ_CONST void *buf, size_t size);
+} mlz_checksum_info;
+
 /* default params wrapped around stdio, just copy and assign handle */
 extern MLZ_API MLZ_CONST mlz_stream_params mlz_default_stream_params;
 
@@ -86,11 +150,41 @@ enum mlz_stream_constants
 	MLZ_MAX_BLOCK_SIZE          = 1 << 29,
 	MLZ_UNCOMPRESSED_BLOCK_MASK = 1 << 30,
 	MLZ_PARTIAL_BLOCK_MASK      = (int)(1u << 31),
-	MLZ_BLOCK_LEN_MASK          = MLZ_UNCOMPRESSED_BLOCK_MASK-1,
+	/* sync block: no context, followed by sync interval */
+	MLZ_SYNC_BLOCK_MASK         = 1 << 29,
+	MLZ_BLOCK_LEN_MASK          = MLZ_SYNC_BLOCK_MASK-1,
+	/* block index trailer magic ("mlzi") */
+	MLZ_INDEX_MAGIC             = 0x697a6c6d,
+	/* log2(block size) value announcing extended stream header */
+	MLZ_HEADER_EXTENDED         = 31,
+	MLZ_HEADER_VERSION          = 1,
+	/* 2-byte header, version, flags, log2(block size), checksum types, */
+	/* optional fields (see flags), LE32 adler32 of extension           */
+	MLZ_MAX_HEADER_SIZE         = 2+4+8+4,
+	/* extended header flags: LE64 content size follows */
+	MLZ_HEADER_CONTENT_SIZE     = 1,
 	/* to support dependent-block streaming */
 	MLZ_BLOCK_CONTEXT_SIZE      = MLZ_MAX_DIST+1,
-	/* maximum # of threads in multi-threaded mode */
-	MLZ_MAX_THREADS             = 32
+	/* deprecated, number of threads is no longer limited */
+	MLZ_MAX_THREADS             = 32,
+	/* segmented raw container (mlz_compress_parallel), LE32 fields:    */
+	/* magic ("mlzs"), uncompressed size, adler32, segment size, context */
+	/* size, then compressed size of each segment (uncompressed block    */
+	/* mask = stored) followed by segment data; segments are compressed  */
+	/* with up to context size bytes preceding them as context           */
+	MLZ_SEGMENTED_MAGIC         = 0x737a6c6d,
+	MLZ_SEGMENTED_HEADER_SIZE   = 5*4,
+	MLZ_SEGMENT_SIZE            = 1 << 20
+};
+
+/* checksum types, stored in extended stream header */
+enum mlz_checksum_type
+{
+	MLZ_CHECKSUM_ADLER32 = 0,
+	/* 64-bit xxhash, block checksum only (stored as LE64) */
+	MLZ_CHECKSUM_XXH64   = 1,
+	MLZ_CHECKSUM_CRC32C  = 2,
+	MLZ_CHECKSUM_COUNT   = 3
 };
 
 #ifdef __cplusplus
@@ -27,6 +27,11 @@
    DEALINGS IN THE SOFTWARE.
 */
 
+/* fseeko with 64-bit offsets on 32-bit systems */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_FILE_OFFSET_BITS)
+#	define _FILE_OFFSET_BITS 64
+#endif
+
 #include "mlz_stream_dec.h"
 #include "mlz_dec.h"
 /* mlz_malloc, mlz_free */
@@ -51,25 +56,51 @@ static mlz_bool mlz_stream_rewind_wrapper(void *handle)
 	return fseek((FILE *)handle, 0, SEEK_SET) == 0;
 }
 
+static mlz_bool mlz_stream_seek_wrapper(void *handle, mlz_long offset)
+{
+	int origin = offset < 0 ? SEEK_END : SEEK_SET;
+
+	/* long is 32-bit on Windows */
+#if defined(_MSC_VER) || defined(__MINGW32__)
+	return _fseeki64((FILE *)handle, offset, origin) == 0;
+#elif defined(__unix__) || defined(__APPLE__)
+	return fseeko((FILE *)handle, (off_t)offset, origin) == 0;
+#else
+	MLZ_RET_FALSE((mlz_long)(long)offset == offset);
+	return fseek((FILE *)handle, (long)offset, origin) == 0;
+#endif
+}
+
 static mlz_bool mlz_stream_close_wrapper(void *handle)
 {
 	return fclose((FILE *)handle) == 0;
 }
 
-/* simple adler32 checksum (Mark Adler's Fletcher variant) */
-mlz_uint
-mlz_adler32(
-	MLZ_CONST void *buf,
+/* x86 SIMD checksums, selected at runtime; define MLZ_NO_SIMD to disable */
+#if !defined(MLZ_NO_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#	if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#		define MLZ_X86_SIMD
+#		define MLZ_TARGET(isa) __attribute__((target(isa)))
+#		include <immintrin.h>
+#	elif defined(_MSC_VER) && _MSC_VER >= 1700
+#		define MLZ_X86_SIMD
+#		define MLZ_TARGET(isa)
+#		include <intrin.h>
+#		include <immintrin.h>
+#	endif
+#endif
+
+/* scalar adler32 */
+static mlz_uint
+mlz_adler32_scalar(
+	MLZ_CONST mlz_byte *b,
 	size_t size,
 	mlz_uint checksum
 )
 {
-	MLZ_CONST mlz_byte *b = (MLZ_CONST mlz_byte *)buf;
 	mlz_uint hi = (checksum >> 16);
 	mlz_uint lo = checksum & 0xffffu;
 
-	MLZ_ASSERT(buf);
-
 	while (size >= 5552) {
 		/* fast path */
 		mlz_uint i;
@@ -135,311 +166,1667 @@ mlz_adler32(
 	return lo | (hi << 16);
 }
 
-mlz_uint
-mlz_adler32_simple(
-	MLZ_CONST void *buf,
-	size_t size
-)
-{
-	return mlz_adler32(buf, size, 1);
-}
+#if defined(MLZ_X86_SIMD)
 
-MLZ_CONST mlz_stream_params mlz_default_stream_params = {
-	/* user data (handle) */
-	MLZ_NULL,
-	/* multi-threaded */
-	MLZ_NULL,
-	mlz_stream_read_wrapper,
-	mlz_stream_write_wrapper,
-	mlz_stream_rewind_wrapper,
-	mlz_stream_close_wrapper,
-	MLZ_NULL,
-	/* compressed block checksum function, returns 32-bit hash */
-	MLZ_NULL,
-	/* incremental uncompressed checksum function */
-	mlz_adler32,
-	/* initial value for incremental checksum   */
-	1,
-	/* desired block size, 65536 is recommended */
-	65536,
-	/* independent blocks flag */
-	MLZ_FALSE,
-	/* unsafe flag */
-	MLZ_FALSE,
-	/* stream header flag */
-	MLZ_TRUE
+/* max # of 32-byte blocks before sums need to be reduced (5552/32) */
+#define MLZ_ADLER32_NMAX_BLOCKS 173
+
+enum
+{
+	MLZ_CPU_SSSE3 = 1,
+	MLZ_CPU_AVX2  = 2,
+	MLZ_CPU_SSE42 = 4
 };
 
-mlz_in_stream *
-mlz_in_stream_open(
-	MLZ_CONST mlz_stream_params *params
+/* returns MLZ_CPU_* flags */
+static int mlz_cpu_features(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	static volatile int features = -1;
+
+	if (features < 0) {
+		int info[4];
+		int res = 0;
+
+		__cpuid(info, 1);
+		if (info[2] & (1 << 9))
+			res |= MLZ_CPU_SSSE3;
+		if (info[2] & (1 << 20))
+			res |= MLZ_CPU_SSE42;
+		/* AVX2 needs OS support for ymm state (OSXSAVE, AVX) */
+		if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+			__cpuid(info, 0);
+			if (info[0] >= 7) {
+				__cpuidex(info, 7, 0);
+				if (info[1] & (1 << 5))
+					res |= MLZ_CPU_AVX2;
+			}
+		}
+		features = res;
+	}
+	return features;
+#else
+	return (__builtin_cpu_supports("ssse3") ? MLZ_CPU_SSSE3 : 0) |
+		(__builtin_cpu_supports("avx2") ? MLZ_CPU_AVX2 : 0) |
+		(__builtin_cpu_supports("sse4.2") ? MLZ_CPU_SSE42 : 0);
+#endif
+}
+
+/* sum-of-products adler32 over 32-byte blocks: */
+/* lo += sum(b[i]), hi += 32*lo_prev + sum((32-i)*b[i]) */
+MLZ_TARGET("ssse3")
+static mlz_uint
+mlz_adler32_ssse3(
+	MLZ_CONST mlz_byte *b,
+	size_t blocks,
+	mlz_uint checksum
 )
 {
-	mlz_byte       *buf;
-	mlz_in_stream  *ins;
-	mlz_int         context_size, reserve, num_threads;
-	mlz_int         block_size;
-	mlz_bool        use_header;
-	mlz_byte        hdr[2];
+	mlz_uint hi = (checksum >> 16);
+	mlz_uint lo = checksum & 0xffffu;
 
-	hdr[0] = hdr[1] = 0;
+	MLZ_CONST __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+	MLZ_CONST __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	MLZ_CONST __m128i zero = _mm_setzero_si128();
+	MLZ_CONST __m128i ones = _mm_set1_epi16(1);
+
+	while (blocks) {
+		size_t  n = blocks < MLZ_ADLER32_NMAX_BLOCKS ? blocks : MLZ_ADLER32_NMAX_BLOCKS;
+		__m128i v_ps = _mm_set_epi32(0, 0, 0, (int)(lo * (mlz_uint)n));
+		__m128i v_s2 = _mm_set_epi32(0, 0, 0, (int)hi);
+		__m128i v_s1 = _mm_setzero_si128();
+
+		blocks -= n;
+
+		do {
+			__m128i bytes1 = _mm_loadu_si128((MLZ_CONST __m128i *)b);
+			__m128i bytes2 = _mm_loadu_si128((MLZ_CONST __m128i *)(b + 16));
+
+			v_ps = _mm_add_epi32(v_ps, v_s1);
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+			b += 32;
+		} while (--n);
+
+		v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+		/* horizontal sums */
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		lo = (lo + (mlz_uint)_mm_cvtsi128_si32(v_s1)) % 65521;
+		hi = (mlz_uint)_mm_cvtsi128_si32(v_s2) % 65521;
+	}
 
-	/* params and read function test */
-	MLZ_RET_FALSE(params && params->read_func);
+	return lo | (hi << 16);
+}
 
-	block_size = params->block_size;
-	use_header = params->use_header;
+/* same as above, one 32-byte block per ymm register */
+MLZ_TARGET("avx2")
+static mlz_uint
+mlz_adler32_avx2(
+	MLZ_CONST mlz_byte *b,
+	size_t blocks,
+	mlz_uint checksum
+)
+{
+	mlz_uint hi = (checksum >> 16);
+	mlz_uint lo = checksum & 0xffffu;
 
-	if (use_header) {
-		/* simple 2-byte block header                */
-		/* bits 4-0: log2(block_size)                */
-		/* bit 5   : independent                     */
-		/* bit 6   : use block checksum (adler32)    */
-		/* bit 7   : use incremental chsum (adler32) */
-		/* 2nd byte = ~hdr (validation)              */
-		MLZ_RET_FALSE(params->read_func(params->handle, hdr, 2) == 2);
-		MLZ_RET_FALSE(hdr[0] == (mlz_byte)~hdr[1]);
-		block_size = (mlz_int)1 << (hdr[0] & 31);
+	MLZ_CONST __m256i tap  = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	MLZ_CONST __m256i zero = _mm256_setzero_si256();
+	MLZ_CONST __m256i ones = _mm256_set1_epi16(1);
+
+	while (blocks) {
+		size_t  n = blocks < MLZ_ADLER32_NMAX_BLOCKS ? blocks : MLZ_ADLER32_NMAX_BLOCKS;
+		__m256i v_ps = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, (int)(lo * (mlz_uint)n));
+		__m256i v_s2 = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, (int)hi);
+		__m256i v_s1 = _mm256_setzero_si256();
+		__m128i s1, s2;
+
+		blocks -= n;
+
+		do {
+			__m256i bytes = _mm256_loadu_si256((MLZ_CONST __m256i *)b);
+
+			v_ps = _mm256_add_epi32(v_ps, v_s1);
+			v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+			v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+			b += 32;
+		} while (--n);
+
+		v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+
+		/* horizontal sums */
+		s1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+		s2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+		s1 = _mm_add_epi32(s1, _mm_shuffle_epi32(s1, _MM_SHUFFLE(2, 3, 0, 1)));
+		s1 = _mm_add_epi32(s1, _mm_shuffle_epi32(s1, _MM_SHUFFLE(1, 0, 3, 2)));
+		s2 = _mm_add_epi32(s2, _mm_shuffle_epi32(s2, _MM_SHUFFLE(2, 3, 0, 1)));
+		s2 = _mm_add_epi32(s2, _mm_shuffle_epi32(s2, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		lo = (lo + (mlz_uint)_mm_cvtsi128_si32(s1)) % 65521;
+		hi = (mlz_uint)_mm_cvtsi128_si32(s2) % 65521;
 	}
 
-	/* block size test */
-	MLZ_RET_FALSE(block_size >= MLZ_MIN_BLOCK_SIZE && block_size < MLZ_MAX_BLOCK_SIZE);
-	/* power of two test */
-	MLZ_RET_FALSE(!((mlz_uint)block_size & ((mlz_uint)block_size-1)));
-
-	ins = (mlz_in_stream *)mlz_malloc(sizeof(mlz_in_stream));
-	MLZ_RET_FALSE(ins);
+	return lo | (hi << 16);
+}
 
-#if defined(MLZ_THREADS)
-	ins->mutex = mlz_mutex_create();
-	if (!ins->mutex) {
-		mlz_free(ins);
-		return MLZ_NULL;
-	}
 #endif
 
-	ins->params = *params;
-	if (use_header) {
-		ins->params.block_size           = block_size;
-		ins->params.independent_blocks   = (hdr[0] & 0x20) != 0;
-		ins->params.block_checksum       = MLZ_NULL;
-		ins->params.incremental_checksum = MLZ_NULL;
-		if ((hdr[0] & 0x40) != 0)
-			ins->params.block_checksum = mlz_adler32_simple;
-		if ((hdr[0] & 0x80) != 0)
-			ins->params.incremental_checksum = mlz_adler32;
-		/* adler32 init */
-		ins->params.initial_checksum = 1;
-	}
+/* simple adler32 checksum (Mark Adler's Fletcher variant) */
+mlz_uint
+mlz_adler32(
+	MLZ_CONST void *buf,
+	size_t size,
+	mlz_uint checksum
+)
+{
+	MLZ_CONST mlz_byte *b = (MLZ_CONST mlz_byte *)buf;
 
-	context_size = MLZ_BLOCK_CONTEXT_SIZE;
-	if (context_size > block_size)
-		context_size = block_size;
+	MLZ_ASSERT(buf);
 
-	num_threads = 1;
+#if defined(MLZ_X86_SIMD)
+	if (size >= 64) {
+		int features = mlz_cpu_features();
 
-	if (ins->params.independent_blocks) {
-		context_size = 0;
-#if defined(MLZ_THREADS)
-		if (params->jobs) {
-			num_threads += params->jobs->num_threads;
-			if (num_threads < 1 || num_threads > MLZ_MAX_THREADS) {
-				(void)mlz_mutex_destroy(ins->mutex);
-				mlz_free(ins);
-				return MLZ_NULL;
-			}
+		if (features & (MLZ_CPU_SSSE3 | MLZ_CPU_AVX2)) {
+			size_t blocks = size / 32;
+
+			checksum = (features & MLZ_CPU_AVX2) ? mlz_adler32_avx2(b, blocks, checksum) :
+				mlz_adler32_ssse3(b, blocks, checksum);
+			b    += blocks*32;
+			size -= blocks*32;
 		}
-#endif
 	}
+#endif
 
-	/* in-place decompress reserve (max inflation is 1 bit per byte) */
-	reserve = block_size/8 + MLZ_CACHELINE_ALIGN;
+	return mlz_adler32_scalar(b, size, checksum);
+}
 
-	ins->buffer_unaligned = buf = (mlz_byte *)mlz_malloc(context_size + (block_size + reserve)*num_threads + MLZ_CACHELINE_ALIGN-1);
-	if (!buf) {
-#if defined(MLZ_THREADS)
-		(void)mlz_mutex_destroy(ins->mutex);
-#endif
-		mlz_free(ins);
-		return MLZ_NULL;
-	}
+mlz_uint
+mlz_adler32_combine(
+	mlz_uint prev,
+	mlz_uint next,
+	size_t next_size
+)
+{
+	/* see zlib's adler32_combine; next must start from 1 */
+	mlz_uint rem = (mlz_uint)(next_size % 65521);
+	mlz_uint lo  = prev & 0xffffu;
+	mlz_uint hi  = rem * lo % 65521;
+
+	lo += (next & 0xffffu) + 65521 - 1;
+	hi += (prev >> 16) + (next >> 16) + 65521 - rem;
+
+	if (lo >= 65521)
+		lo -= 65521;
+	if (lo >= 65521)
+		lo -= 65521;
+	if (hi >= 2*65521)
+		hi -= 2*65521;
+	if (hi >= 65521)
+		hi -= 65521;
 
-	buf = (mlz_byte *)((mlz_uintptr)buf & ~((mlz_uintptr)MLZ_CACHELINE_ALIGN-1));
-	if (buf < ins->buffer_unaligned)
-		buf += MLZ_CACHELINE_ALIGN;
+	return lo | (hi << 16);
+}
 
-	MLZ_ASSERT(buf >= ins->buffer_unaligned);
-	ins->buffer = buf;
-
-	ins->checksum        = ins->params.initial_checksum;
-	ins->block_size      = block_size;
-	ins->block_reserve   = reserve;
-	ins->context_size    = context_size;
-	ins->next_block_size = 0;
-	ins->num_threads     = num_threads;
-	ins->current_block   = 0;
-	ins->num_blocks      = 0;
-	ins->ptr             = MLZ_NULL;
-	ins->top             = MLZ_NULL;
-	ins->is_eof          = MLZ_FALSE;
-	ins->first_block     = MLZ_TRUE;
-	ins->first_cached    = MLZ_FALSE;
-	return ins;
+mlz_uint
+mlz_adler32_simple(
+	MLZ_CONST void *buf,
+	size_t size
+)
+{
+	return mlz_adler32(buf, size, 1);
 }
 
-static mlz_bool mlz_read_little_endian(mlz_in_stream *stream, mlz_uint *val)
+static mlz_uint mlz_load_little_endian(MLZ_CONST mlz_byte *buf)
 {
-	mlz_byte buf[4];
-	MLZ_ASSERT(val);
-	MLZ_RET_FALSE(stream->params.read_func(stream->params.handle, buf, 4) == 4);
-	*val = buf[0] + (buf[1] << 8) + (buf[2] << 16) + ((mlz_uint)buf[3] << 24);
-	return MLZ_TRUE;
+	return buf[0] + (buf[1] << 8) + (buf[2] << 16) + ((mlz_uint)buf[3] << 24);
 }
 
-static void mlz_decompress_block_job(int thread, void *param)
+static mlz_ulong mlz_load_little_endian64(MLZ_CONST mlz_byte *buf)
 {
-	mlz_in_stream *stream = (mlz_in_stream *)param;
+	return (mlz_ulong)mlz_load_little_endian(buf) | ((mlz_ulong)mlz_load_little_endian(buf + 4) << 32);
+}
 
-	mlz_int blk_ofs  = thread * (stream->block_size + stream->block_reserve);
-	mlz_byte *target = stream->block_targets[thread];
-	mlz_int blk_size = stream->blk_sizes[thread];
+/* CRC32C (Castagnoli), reflected polynomial */
+#define MLZ_CRC32C_POLY 0x82f63b78u
+
+static MLZ_CONST mlz_uint mlz_crc32c_table[256] = {
+	0x00000000u, 0xf26b8303u, 0xe13b70f7u, 0x1350f3f4u, 0xc79a971fu, 0x35f1141cu,
+	0x26a1e7e8u, 0xd4ca64ebu, 0x8ad958cfu, 0x78b2dbccu, 0x6be22838u, 0x9989ab3bu,
+	0x4d43cfd0u, 0xbf284cd3u, 0xac78bf27u, 0x5e133c24u, 0x105ec76fu, 0xe235446cu,
+	0xf165b798u, 0x030e349bu, 0xd7c45070u, 0x25afd373u, 0x36ff2087u, 0xc494a384u,
+	0x9a879fa0u, 0x68ec1ca3u, 0x7bbcef57u, 0x89d76c54u, 0x5d1d08bfu, 0xaf768bbcu,
+	0xbc267848u, 0x4e4dfb4bu, 0x20bd8edeu, 0xd2d60dddu, 0xc186fe29u, 0x33ed7d2au,
+	0xe72719c1u, 0x154c9ac2u, 0x061c6936u, 0xf477ea35u, 0xaa64d611u, 0x580f5512u,
+	0x4b5fa6e6u, 0xb93425e5u, 0x6dfe410eu, 0x9f95c20du, 0x8cc531f9u, 0x7eaeb2fau,
+	0x30e349b1u, 0xc288cab2u, 0xd1d83946u, 0x23b3ba45u, 0xf779deaeu, 0x05125dadu,
+	0x1642ae59u, 0xe4292d5au, 0xba3a117eu, 0x4851927du, 0x5b016189u, 0xa96ae28au,
+	0x7da08661u, 0x8fcb0562u, 0x9c9bf696u, 0x6ef07595u, 0x417b1dbcu, 0xb3109ebfu,
+	0xa0406d4bu, 0x522bee48u, 0x86e18aa3u, 0x748a09a0u, 0x67dafa54u, 0x95b17957u,
+	0xcba24573u, 0x39c9c670u, 0x2a993584u, 0xd8f2b687u, 0x0c38d26cu, 0xfe53516fu,
+	0xed03a29bu, 0x1f682198u, 0x5125dad3u, 0xa34e59d0u, 0xb01eaa24u, 0x42752927u,
+	0x96bf4dccu, 0x64d4cecfu, 0x77843d3bu, 0x85efbe38u, 0xdbfc821cu, 0x2997011fu,
+	0x3ac7f2ebu, 0xc8ac71e8u, 0x1c661503u, 0xee0d9600u, 0xfd5d65f4u, 0x0f36e6f7u,
+	0x61c69362u, 0x93ad1061u, 0x80fde395u, 0x72966096u, 0xa65c047du, 0x5437877eu,
+	0x4767748au, 0xb50cf789u, 0xeb1fcbadu, 0x197448aeu, 0x0a24bb5au, 0xf84f3859u,
+	0x2c855cb2u, 0xdeeedfb1u, 0xcdbe2c45u, 0x3fd5af46u, 0x7198540du, 0x83f3d70eu,
+	0x90a324fau, 0x62c8a7f9u, 0xb602c312u, 0x44694011u, 0x5739b3e5u, 0xa55230e6u,
+	0xfb410cc2u, 0x092a8fc1u, 0x1a7a7c35u, 0xe811ff36u, 0x3cdb9bddu, 0xceb018deu,
+	0xdde0eb2au, 0x2f8b6829u, 0x82f63b78u, 0x709db87bu, 0x63cd4b8fu, 0x91a6c88cu,
+	0x456cac67u, 0xb7072f64u, 0xa457dc90u, 0x563c5f93u, 0x082f63b7u, 0xfa44e0b4u,
+	0xe9141340u, 0x1b7f9043u, 0xcfb5f4a8u, 0x3dde77abu, 0x2e8e845fu, 0xdce5075cu,
+	0x92a8fc17u, 0x60c37f14u, 0x73938ce0u, 0x81f80fe3u, 0x55326b08u, 0xa759e80bu,
+	0xb4091bffu, 0x466298fcu, 0x1871a4d8u, 0xea1a27dbu, 0xf94ad42fu, 0x0b21572cu,
+	0xdfeb33c7u, 0x2d80b0c4u, 0x3ed04330u, 0xccbbc033u, 0xa24bb5a6u, 0x502036a5u,
+	0x4370c551u, 0xb11b4652u, 0x65d122b9u, 0x97baa1bau, 0x84ea524eu, 0x7681d14du,
+	0x2892ed69u, 0xdaf96e6au, 0xc9a99d9eu, 0x3bc21e9du, 0xef087a76u, 0x1d63f975u,
+	0x0e330a81u, 0xfc588982u, 0xb21572c9u, 0x407ef1cau, 0x532e023eu, 0xa145813du,
+	0x758fe5d6u, 0x87e466d5u, 0x94b49521u, 0x66df1622u, 0x38cc2a06u, 0xcaa7a905u,
+	0xd9f75af1u, 0x2b9cd9f2u, 0xff56bd19u, 0x0d3d3e1au, 0x1e6dcdeeu, 0xec064eedu,
+	0xc38d26c4u, 0x31e6a5c7u, 0x22b65633u, 0xd0ddd530u, 0x0417b1dbu, 0xf67c32d8u,
+	0xe52cc12cu, 0x1747422fu, 0x49547e0bu, 0xbb3ffd08u, 0xa86f0efcu, 0x5a048dffu,
+	0x8ecee914u, 0x7ca56a17u, 0x6ff599e3u, 0x9d9e1ae0u, 0xd3d3e1abu, 0x21b862a8u,
+	0x32e8915cu, 0xc083125fu, 0x144976b4u, 0xe622f5b7u, 0xf5720643u, 0x07198540u,
+	0x590ab964u, 0xab613a67u, 0xb831c993u, 0x4a5a4a90u, 0x9e902e7bu, 0x6cfbad78u,
+	0x7fab5e8cu, 0x8dc0dd8fu, 0xe330a81au, 0x115b2b19u, 0x020bd8edu, 0xf0605beeu,
+	0x24aa3f05u, 0xd6c1bc06u, 0xc5914ff2u, 0x37faccf1u, 0x69e9f0d5u, 0x9b8273d6u,
+	0x88d28022u, 0x7ab90321u, 0xae7367cau, 0x5c18e4c9u, 0x4f48173du, 0xbd23943eu,
+	0xf36e6f75u, 0x0105ec76u, 0x12551f82u, 0xe03e9c81u, 0x34f4f86au, 0xc69f7b69u,
+	0xd5cf889du, 0x27a40b9eu, 0x79b737bau, 0x8bdcb4b9u, 0x988c474du, 0x6ae7c44eu,
+	0xbe2da0a5u, 0x4c4623a6u, 0x5f16d052u, 0xad7d5351u
+};
 
-	if (!stream->unc_blocks[thread]) {
-		mlz_int usize = stream->usizes[thread];
-		/* and finally: decompress (in-place) */
-		size_t dlen = stream->params.unsafe ?
-			mlz_decompress_unsafe(stream->buffer + stream->context_size + blk_ofs, target,
-			blk_size)
-			: mlz_decompress(stream->buffer + stream->context_size + blk_ofs, usize, target,
-				blk_size, stream->context_size * (stream->first_block != MLZ_TRUE));
-#if defined(MLZ_THREADS)
-		(void)mlz_mutex_lock(stream->mutex);
-		stream->dlens[thread] = dlen;
-		(void)mlz_mutex_unlock(stream->mutex);
-#else
-		stream->dlens[thread] = dlen;
+#if defined(MLZ_X86_SIMD)
+
+/* hardware CRC32C (SSE4.2) */
+MLZ_TARGET("sse4.2")
+static mlz_uint
+mlz_crc32c_sse42(
+	MLZ_CONST mlz_byte *b,
+	size_t size,
+	mlz_uint crc
+)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	mlz_ulong crc64 = crc;
+
+	while (size >= 8) {
+		mlz_ulong val;
+		memcpy(&val, b, 8);
+		crc64 = _mm_crc32_u64(crc64, val);
+		b    += 8;
+		size -= 8;
+	}
+	crc = (mlz_uint)crc64;
 #endif
+
+	while (size >= 4) {
+		mlz_uint val;
+		memcpy(&val, b, 4);
+		crc   = _mm_crc32_u32(crc, val);
+		b    += 4;
+		size -= 4;
 	}
+
+	while (size--)
+		crc = _mm_crc32_u8(crc, *b++);
+
+	return crc;
 }
 
-static mlz_bool
-mlz_in_stream_read_block(mlz_in_stream *stream)
+#endif
+
+mlz_uint
+mlz_crc32c(
+	MLZ_CONST void *buf,
+	size_t size,
+	mlz_uint checksum
+)
 {
-	mlz_uint  blk_size;
-	mlz_uint  usize;
-	mlz_int   i;
-	mlz_byte *target;
-	mlz_uint  block_checksum = 0;
-	mlz_int   in_blocks = 0;
-	mlz_int   in_blocks_threaded = 0;
+	MLZ_CONST mlz_byte *b = (MLZ_CONST mlz_byte *)buf;
+	mlz_uint crc = ~checksum;
 
-	stream->current_block = 0;
-	stream->num_blocks    = 0;
+	MLZ_ASSERT(buf);
 
-	blk_size = 0;
-	for (i=0; i<stream->num_threads; i++) {
-		mlz_bool  partial, uncompressed;
-		mlz_int   target_pos;
-		mlz_int   blk_ofs = i*(stream->block_size + stream->block_reserve);
+#if defined(MLZ_X86_SIMD)
+	if (mlz_cpu_features() & MLZ_CPU_SSE42)
+		return ~mlz_crc32c_sse42(b, size, crc);
+#endif
 
-		if (stream->next_block_size) {
-			blk_size = stream->next_block_size;
-			stream->next_block_size = 0;
-		} else {
-			MLZ_RET_FALSE(mlz_read_little_endian(stream, &blk_size));
-		}
+	while (size--)
+		crc = (crc >> 8) ^ mlz_crc32c_table[(crc ^ *b++) & 255];
 
-		partial      = (blk_size & MLZ_PARTIAL_BLOCK_MASK) != 0;
-		uncompressed = (blk_size & MLZ_UNCOMPRESSED_BLOCK_MASK) != 0;
+	return ~crc;
+}
 
-		blk_size &= MLZ_BLOCK_LEN_MASK;
+/* multiply polynomials a, b modulo CRC32C polynomial (reflected) */
+static mlz_uint mlz_crc32c_multmodp(mlz_uint a, mlz_uint b)
+{
+	mlz_uint m = 1u << 31;
+	mlz_uint p = 0;
 
-		MLZ_RET_FALSE(blk_size <= (mlz_uint)stream->block_size);
+	while (a) {
+		if (a & m) {
+			p ^= b;
+			a &= ~m;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ MLZ_CRC32C_POLY : b >> 1;
+	}
 
-		if (blk_size == 0)
-			break;
+	return p;
+}
 
-		usize = stream->block_size;
+mlz_uint
+mlz_crc32c_combine(
+	mlz_uint prev,
+	mlz_uint next,
+	size_t next_size
+)
+{
+	/* prev * x^(8*next_size) + next; see zlib's crc32_combine */
+	mlz_uint xn = 1u << 31;
+	mlz_uint sq = 1u << 23;
+
+	while (next_size) {
+		if (next_size & 1)
+			xn = mlz_crc32c_multmodp(sq, xn);
+		sq = mlz_crc32c_multmodp(sq, sq);
+		next_size >>= 1;
+	}
 
-		/* load block checksum if needed */
-		if (stream->params.block_checksum)
-			MLZ_RET_FALSE(mlz_read_little_endian(stream, &block_checksum));
+	return mlz_crc32c_multmodp(xn, prev) ^ next;
+}
 
-		if (partial)
-			MLZ_RET_FALSE(mlz_read_little_endian(stream, &usize) &&
-				usize > 0 && usize <= (mlz_uint)stream->block_size);
+mlz_uint
+mlz_crc32c_simple(
+	MLZ_CONST void *buf,
+	size_t size
+)
+{
+	return mlz_crc32c(buf, size, 0);
+}
 
-		target_pos = stream->context_size + blk_ofs + (stream->block_size + stream->block_reserve) - blk_size;
-		/* make sure buffer is aligned, we have reserve anyway */
-		target_pos &= ~(mlz_uintptr)7;
+/* xxhash64 (Yann Collet) */
+#define MLZ_U64(hi, lo) (((mlz_ulong)(hi) << 32) | (mlz_ulong)(lo))
+#define MLZ_XXH_PRIME1  MLZ_U64(0x9e3779b1u, 0x85ebca87u)
+#define MLZ_XXH_PRIME2  MLZ_U64(0xc2b2ae3du, 0x27d4eb4fu)
+#define MLZ_XXH_PRIME3  MLZ_U64(0x165667b1u, 0x9e3779f9u)
+#define MLZ_XXH_PRIME4  MLZ_U64(0x85ebca77u, 0xc2b2ae63u)
+#define MLZ_XXH_PRIME5  MLZ_U64(0x27d4eb2fu, 0x165667c5u)
 
-		target = stream->buffer + target_pos;
-		if (uncompressed)
-			/* special handling of uncompressed blocks */
-			target = stream->buffer + stream->context_size + blk_ofs;
+MLZ_INLINE mlz_ulong mlz_rotl64(mlz_ulong x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
 
-		stream->blk_sizes[in_blocks]       = blk_size;
-		stream->usizes[in_blocks]          = usize;
-		stream->unc_blocks[in_blocks]      = uncompressed;
-		stream->block_targets[in_blocks++] = target;
+MLZ_INLINE mlz_ulong mlz_xxh64_round(mlz_ulong acc, mlz_ulong val)
+{
+	acc += val * MLZ_XXH_PRIME2;
+	return mlz_rotl64(acc, 31) * MLZ_XXH_PRIME1;
+}
 
-		in_blocks_threaded += (i>0) && !uncompressed;
+MLZ_INLINE mlz_ulong mlz_xxh64_merge(mlz_ulong acc, mlz_ulong val)
+{
+	acc ^= mlz_xxh64_round(0, val);
+	return acc * MLZ_XXH_PRIME1 + MLZ_XXH_PRIME4;
+}
 
-		MLZ_RET_FALSE(stream->params.read_func(stream->params.handle, target,
-			(mlz_intptr)blk_size) == (mlz_intptr)blk_size);
+mlz_ulong
+mlz_xxh64(
+	MLZ_CONST void *buf,
+	size_t size,
+	mlz_ulong seed
+)
+{
+	MLZ_CONST mlz_byte *b = (MLZ_CONST mlz_byte *)buf;
+	mlz_ulong h;
 
-		/* validate compressed checksum */
-		if (!stream->params.unsafe && stream->params.block_checksum)
-			MLZ_RET_FALSE(stream->params.block_checksum(target, blk_size) == block_checksum);
-	}
+	MLZ_ASSERT(buf);
 
-	(void)in_blocks_threaded;
-#if defined(MLZ_THREADS)
-	MLZ_RET_FALSE(!stream->params.jobs || mlz_jobs_prepare_batch(stream->params.jobs, in_blocks_threaded));
-	for (i=1; i<in_blocks; i++) {
-		mlz_job job;
-		if (stream->unc_blocks[i])
-			continue;
-		job.param = stream;
-		job.job = mlz_decompress_block_job;
-		job.idx = i;
-		MLZ_RET_FALSE(mlz_jobs_enqueue(stream->params.jobs, job));
+	if (size >= 32) {
+		MLZ_CONST mlz_byte *limit = b + size - 32;
+		mlz_ulong v1 = seed + MLZ_XXH_PRIME1 + MLZ_XXH_PRIME2;
+		mlz_ulong v2 = seed + MLZ_XXH_PRIME2;
+		mlz_ulong v3 = seed;
+		mlz_ulong v4 = seed - MLZ_XXH_PRIME1;
+
+		do {
+			v1 = mlz_xxh64_round(v1, mlz_load_little_endian64(b));
+			v2 = mlz_xxh64_round(v2, mlz_load_little_endian64(b + 8));
+			v3 = mlz_xxh64_round(v3, mlz_load_little_endian64(b + 16));
+			v4 = mlz_xxh64_round(v4, mlz_load_little_endian64(b + 24));
+			b += 32;
+		} while (b <= limit);
+
+		h = mlz_rotl64(v1, 1) + mlz_rotl64(v2, 7) + mlz_rotl64(v3, 12) + mlz_rotl64(v4, 18);
+		h = mlz_xxh64_merge(h, v1);
+		h = mlz_xxh64_merge(h, v2);
+		h = mlz_xxh64_merge(h, v3);
+		h = mlz_xxh64_merge(h, v4);
+	} else {
+		h = seed + MLZ_XXH_PRIME5;
 	}
-#endif
-	/* this thread helps too */
-	mlz_decompress_block_job(0, stream);
-#if defined(MLZ_THREADS)
-	MLZ_RET_FALSE(in_blocks < 2 || mlz_jobs_wait(stream->params.jobs));
-#endif
 
-	stream->ptr = stream->buffer + stream->context_size;
+	h += (mlz_ulong)size;
+	size &= 31;
 
-	for (i=0; i<in_blocks; i++) {
-		mlz_int ofs = (stream->block_size + stream->block_reserve)*i;
-		usize = stream->usizes[i];
+	while (size >= 8) {
+		h ^= mlz_xxh64_round(0, mlz_load_little_endian64(b));
+		h  = mlz_rotl64(h, 27) * MLZ_XXH_PRIME1 + MLZ_XXH_PRIME4;
+		b    += 8;
+		size -= 8;
+	}
 
-		/* handle decompression errors now */
-		if (!stream->unc_blocks[i] && stream->dlens[i] != (size_t)usize)
-			return MLZ_FALSE;
+	if (size >= 4) {
+		h ^= (mlz_ulong)mlz_load_little_endian(b) * MLZ_XXH_PRIME1;
+		h  = mlz_rotl64(h, 23) * MLZ_XXH_PRIME2 + MLZ_XXH_PRIME3;
+		b    += 4;
+		size -= 4;
+	}
 
-		/* compute incremental checksum if needed */
-		if (stream->params.incremental_checksum)
-			stream->checksum =
-				stream->params.incremental_checksum(stream->buffer + stream->context_size + ofs,
-					usize, stream->checksum);
+	while (size--) {
+		h ^= (*b++) * MLZ_XXH_PRIME5;
+		h  = mlz_rotl64(h, 11) * MLZ_XXH_PRIME1;
 	}
 
-	usize = stream->usizes[0];
-	stream->top = stream->ptr + usize;
+	/* avalanche */
+	h ^= h >> 33;
+	h *= MLZ_XXH_PRIME2;
+	h ^= h >> 29;
+	h *= MLZ_XXH_PRIME3;
+	h ^= h >> 32;
 
-	/* copy context */
-	if (stream->context_size > 0 && usize >= (size_t)stream->context_size)
-		memcpy(stream->buffer, stream->buffer + usize, stream->context_size);
+	return h;
+}
 
-	stream->first_cached = stream->first_block;
-	stream->first_block  = MLZ_FALSE;
+mlz_ulong
+mlz_xxh64_simple(
+	MLZ_CONST void *buf,
+	size_t size
+)
+{
+	return mlz_xxh64(buf, size, 0);
+}
 
-	stream->num_blocks   = in_blocks;
+static MLZ_CONST mlz_checksum_info mlz_checksums[MLZ_CHECKSUM_COUNT] = {
+	/* adler32 */
+	{ mlz_adler32_simple, mlz_adler32, mlz_adler32_combine, 1, MLZ_NULL },
+	/* xxhash64 */
+	{ MLZ_NULL, MLZ_NULL, MLZ_NULL, 0, mlz_xxh64_simple },
+	/* CRC32C */
+	{ mlz_crc32c_simple, mlz_crc32c, mlz_crc32c_combine, 0, MLZ_NULL }
+};
+
+MLZ_CONST mlz_checksum_info *
+mlz_get_checksum_info(
+	mlz_int type
+)
+{
+	return type >= 0 && type < MLZ_CHECKSUM_COUNT ? mlz_checksums + type : MLZ_NULL;
+}
+
+MLZ_CONST mlz_stream_params mlz_default_stream_params = {
+	/* user data (handle) */
+	MLZ_NULL,
+	/* multi-threaded */
+	MLZ_NULL,
+	mlz_stream_read_wrapper,
+	mlz_stream_write_wrapper,
+	mlz_stream_rewind_wrapper,
+	mlz_stream_close_wrapper,
+	MLZ_NULL,
+	/* compressed block checksum function, returns 32-bit hash */
+	MLZ_NULL,
+	/* incremental uncompressed checksum function */
+	mlz_adler32,
+	/* initial value for incremental checksum   */
+	1,
+	/* desired block size, 65536 is recommended */
+	65536,
+	/* independent blocks flag */
+	MLZ_FALSE,
+	/* unsafe flag */
+	MLZ_FALSE,
+	/* stream header flag */
+	MLZ_TRUE,
+	/* pipelined flag */
+	MLZ_FALSE,
+	/* sync interval */
+	0,
+	/* block index flag */
+	MLZ_FALSE,
+	/* seek callback */
+	mlz_stream_seek_wrapper,
+	/* incremental checksum combine function (derived from known checksums) */
+	MLZ_NULL,
+	/* 64-bit compressed block checksum function */
+	MLZ_NULL,
+	/* content size (unknown) */
+	0,
+	/* read-ahead buffer size (off: don't read past end of stream) */
+	0,
+	/* async read flag */
+	MLZ_FALSE,
+	/* minimum block size (adaptive block size off) */
+	0,
+	/* multi-frame flag */
+	MLZ_FALSE,
+	/* allocator (mlz_malloc) */
+	MLZ_NULL
+};
+
+#if defined(MLZ_THREADS)
+
+/* background reader: reads next buffer on request */
+static void mlz_in_stream_reader_proc(void *param)
+{
+	mlz_in_stream *stream = (mlz_in_stream *)param;
+
+	for (;;) {
+		(void)mlz_event_wait(stream->read_start_event);
+		(void)mlz_event_reset(stream->read_start_event);
+		if (stream->read_stop)
+			break;
+		stream->read_back_size = stream->params.read_func(stream->params.handle, stream->read_back,
+			stream->read_size);
+		(void)mlz_event_set(stream->read_done_event);
+	}
+}
+
+static mlz_bool mlz_in_stream_init_reader(mlz_in_stream *stream)
+{
+	stream->read_back        = (mlz_byte *)mlz_alloc(stream->params.allocator, stream->read_size);
+	stream->read_start_event = mlz_event_create();
+	stream->read_done_event  = mlz_event_create();
+	stream->read_pending     = MLZ_FALSE;
+	stream->read_stop        = MLZ_FALSE;
+
+	MLZ_RET_FALSE(stream->read_back && stream->read_start_event && stream->read_done_event);
+	MLZ_RET_FALSE(mlz_event_reset(stream->read_start_event) && mlz_event_reset(stream->read_done_event));
+
+	stream->reader = mlz_thread_create();
+	MLZ_RET_FALSE(stream->reader);
+
+	if (!mlz_thread_run(stream->reader, mlz_in_stream_reader_proc, stream)) {
+		(void)mlz_thread_destroy(stream->reader);
+		stream->reader = MLZ_NULL;
+		return MLZ_FALSE;
+	}
+
+	return MLZ_TRUE;
+}
+
+/* start reading next buffer in background */
+static mlz_bool mlz_in_stream_read_async(mlz_in_stream *stream)
+{
+	MLZ_RET_FALSE(mlz_event_set(stream->read_start_event));
+	stream->read_pending = MLZ_TRUE;
+	return MLZ_TRUE;
+}
+
+/* wait for background read in flight, returns its result (0 if none) */
+static mlz_intptr mlz_in_stream_read_wait(mlz_in_stream *stream)
+{
+	if (!stream->read_pending)
+		return 0;
+
+	stream->read_pending = MLZ_FALSE;
+
+	if (!mlz_event_wait(stream->read_done_event) || !mlz_event_reset(stream->read_done_event))
+		return -1;
+
+	return stream->read_back_size;
+}
+
+static mlz_bool mlz_in_stream_stop_reader(mlz_in_stream *stream)
+{
+	if (stream->reader) {
+		(void)mlz_in_stream_read_wait(stream);
+		stream->read_stop = MLZ_TRUE;
+		MLZ_RET_FALSE(mlz_event_set(stream->read_start_event) && mlz_thread_destroy(stream->reader));
+		stream->reader = MLZ_NULL;
+	}
+
+	if (stream->read_start_event) {
+		MLZ_RET_FALSE(mlz_event_destroy(stream->read_start_event));
+		stream->read_start_event = MLZ_NULL;
+	}
+
+	if (stream->read_done_event) {
+		MLZ_RET_FALSE(mlz_event_destroy(stream->read_done_event));
+		stream->read_done_event = MLZ_NULL;
+	}
+
+	if (stream->read_back) {
+		mlz_dealloc(stream->params.allocator, stream->read_back);
+		stream->read_back = MLZ_NULL;
+	}
+
+	return MLZ_TRUE;
+}
+
+#endif
+
+/* largest batch prefetched by background reader */
+#define MLZ_MAX_READ_BATCH (1 << 23)
+
+/* read-ahead buffer size; background reader reads at least one batch */
+/* of compressed blocks (up to block size each) at a time              */
+static mlz_intptr mlz_in_stream_read_size(MLZ_CONST mlz_stream_params *params)
+{
+	mlz_intptr size = params->read_ahead;
+
+#if defined(MLZ_THREADS)
+	if (size > 0 && params->async_read) {
+		mlz_intptr n     = 1 + (params->jobs ? params->jobs->num_threads : 0);
+		mlz_intptr batch = params->block_size > MLZ_MAX_READ_BATCH/n ?
+			MLZ_MAX_READ_BATCH : params->block_size*n;
+
+		if (batch > size)
+			size = batch;
+	}
+#endif
+
+	return size;
+}
+
+/* reading in background thread? */
+static mlz_bool mlz_in_stream_async_read(mlz_in_stream *stream)
+{
+#if defined(MLZ_THREADS)
+	return stream->reader != MLZ_NULL;
+#else
+	(void)stream;
+	return MLZ_FALSE;
+#endif
+}
+
+/* parse stream header; first 2 bytes are already in hdr, */
+/* rest of extended header is fetched using read_func     */
+static mlz_bool mlz_parse_header(
+	mlz_byte      *hdr,
+	mlz_intptr   (*read_func)(void *handle, void *buf, mlz_intptr size),
+	void          *handle,
+	mlz_in_header *res
+)
+{
+	/* simple 2-byte block header                */
+	/* bits 4-0: log2(block_size)                */
+	/* bit 5   : independent                     */
+	/* bit 6   : use block checksum (adler32)    */
+	/* bit 7   : use incremental chsum (adler32) */
+	/* 2nd byte = ~hdr (validation)              */
+	MLZ_RET_FALSE(hdr[0] == (mlz_byte)~hdr[1]);
+
+	res->flags                = (mlz_byte)(hdr[0] & 0xe0);
+	res->size                 = 2;
+	res->content_size         = -1;
+	res->block_checksum       = mlz_get_checksum_info(MLZ_CHECKSUM_ADLER32);
+	res->incremental_checksum = res->block_checksum;
+
+	if ((hdr[0] & 31) == MLZ_HEADER_EXTENDED) {
+		/* extended header (see mlz_stream_enc.c) */
+		MLZ_RET_FALSE(read_func(handle, hdr + 2, 4) == 4);
+		MLZ_RET_FALSE(hdr[2] == MLZ_HEADER_VERSION && !(hdr[3] & ~MLZ_HEADER_CONTENT_SIZE) && hdr[4] < 31);
+		res->size = 6 + 8*((hdr[3] & MLZ_HEADER_CONTENT_SIZE) != 0);
+		MLZ_RET_FALSE(read_func(handle, hdr + 6, res->size-6+4) == res->size-6+4);
+		MLZ_RET_FALSE(mlz_adler32(hdr + 2, res->size-2, 1) == mlz_load_little_endian(hdr + res->size));
+		if (hdr[3] & MLZ_HEADER_CONTENT_SIZE) {
+			res->content_size = (mlz_long)mlz_load_little_endian64(hdr + 6);
+			MLZ_RET_FALSE(res->content_size >= 0);
+		}
+		res->size += 4;
+		res->block_checksum       = mlz_get_checksum_info(hdr[5] & 15);
+		res->incremental_checksum = mlz_get_checksum_info(hdr[5] >> 4);
+		MLZ_RET_FALSE(res->block_checksum && res->incremental_checksum &&
+			res->incremental_checksum->incremental_checksum);
+		res->block_size = (mlz_int)1 << hdr[4];
+	} else {
+		res->block_size = (mlz_int)1 << (hdr[0] & 31);
+	}
+
+	return MLZ_TRUE;
+}
+
+/* known incremental checksum implies combine function (initial value must */
+/* match); custom checksum functions use combine_checksum as given         */
+static void mlz_in_stream_derive_combine(mlz_in_stream *stream)
+{
+	mlz_int i;
+
+	for (i=0; stream->params.incremental_checksum && i<MLZ_CHECKSUM_COUNT; i++) {
+		if (stream->params.incremental_checksum == mlz_checksums[i].incremental_checksum) {
+			stream->params.combine_checksum =
+				stream->params.initial_checksum == mlz_checksums[i].initial_checksum ?
+				mlz_checksums[i].combine_checksum : MLZ_NULL;
+			return;
+		}
+	}
+}
+
+/* take over parameters stored in stream header */
+static void mlz_in_stream_apply_header(mlz_in_stream *stream, MLZ_CONST mlz_in_header *hdr)
+{
+	stream->params.block_size           = hdr->block_size;
+	stream->params.independent_blocks   = (hdr->flags & 0x20) != 0;
+	stream->params.block_checksum       = MLZ_NULL;
+	stream->params.block_checksum64     = MLZ_NULL;
+	stream->params.incremental_checksum = MLZ_NULL;
+	stream->params.combine_checksum     = MLZ_NULL;
+	if ((hdr->flags & 0x40) != 0) {
+		stream->params.block_checksum   = hdr->block_checksum->block_checksum;
+		stream->params.block_checksum64 = hdr->block_checksum->block_checksum64;
+	}
+	if ((hdr->flags & 0x80) != 0) {
+		stream->params.incremental_checksum = hdr->incremental_checksum->incremental_checksum;
+		stream->params.combine_checksum     = hdr->incremental_checksum->combine_checksum;
+	}
+	stream->params.initial_checksum = hdr->incremental_checksum->initial_checksum;
+	stream->params.content_size     = hdr->content_size;
+	stream->header_size             = hdr->size;
+}
+
+/* grow per-thread arrays (contents are only used within a batch) */
+static mlz_bool mlz_in_stream_alloc_threads(mlz_in_stream *stream, mlz_int num_threads)
+{
+	mlz_byte *buf;
+	size_t    n = (size_t)num_threads;
+
+	if (num_threads <= stream->max_threads)
+		return MLZ_TRUE;
+
+	buf = (mlz_byte *)mlz_alloc(stream->params.allocator, n*(sizeof(mlz_byte *) + sizeof(size_t) +
+		sizeof(mlz_ulong) + 3*sizeof(mlz_int) + sizeof(mlz_bool) + sizeof(mlz_uint)));
+	MLZ_RET_FALSE(buf);
+
+	mlz_dealloc(stream->params.allocator, stream->thread_data);
+	stream->thread_data = buf;
+	stream->max_threads = num_threads;
+
+	/* 64-bit values, pointers and size_t first to keep alignment */
+	stream->blk_checksums = (mlz_ulong *)buf;
+	buf                  += n*sizeof(mlz_ulong);
+	stream->block_targets = (MLZ_CONST mlz_byte **)buf;
+	buf                  += n*sizeof(mlz_byte *);
+	stream->dlens         = (size_t *)buf;
+	buf                  += n*sizeof(size_t);
+	stream->blk_sizes     = (mlz_int *)buf;
+	stream->usizes        = stream->blk_sizes + n;
+	stream->group_counts  = stream->usizes + n;
+	stream->checksums     = (mlz_uint *)(stream->group_counts + n);
+	stream->unc_blocks    = (mlz_bool *)(stream->checksums + n);
+	return MLZ_TRUE;
+}
+
+/* (re)allocate buffer for current block size and block type */
+/* (buffer already allocated is kept if large enough)        */
+static mlz_bool mlz_in_stream_alloc_buffer(mlz_in_stream *stream)
+{
+	mlz_byte *buf;
+	mlz_int   block_size  = stream->params.block_size;
+	mlz_int   num_threads = 1;
+	mlz_int   context_size, reserve;
+	size_t    size;
+
+	/* block size test */
+	MLZ_RET_FALSE(block_size >= MLZ_MIN_BLOCK_SIZE && block_size < MLZ_MAX_BLOCK_SIZE);
+	/* power of two test */
+	MLZ_RET_FALSE(!((mlz_uint)block_size & ((mlz_uint)block_size-1)));
+
+	context_size = MLZ_BLOCK_CONTEXT_SIZE;
+	if (context_size > block_size)
+		context_size = block_size;
+
+	if (stream->params.independent_blocks) {
+		context_size = 0;
+#if defined(MLZ_THREADS)
+		if (stream->params.jobs) {
+			num_threads += stream->params.jobs->num_threads;
+			MLZ_RET_FALSE(num_threads >= 1);
+		}
+#endif
+	}
+
+	/* in-place decompress reserve (max inflation is 1 bit per byte) */
+	reserve = block_size/8 + MLZ_CACHELINE_ALIGN;
+
+	/* many threads with large blocks may not fit (32-bit), reject */
+	MLZ_RET_FALSE((size_t)num_threads <=
+		(((size_t)-1 >> 1) - (size_t)context_size)/(size_t)(block_size + reserve));
+
+	MLZ_RET_FALSE(mlz_in_stream_alloc_threads(stream, num_threads));
+
+	size = (size_t)context_size + (size_t)(block_size + reserve)*(size_t)num_threads;
+
+	if (size > stream->buffer_size) {
+		buf = (mlz_byte *)mlz_alloc(stream->params.allocator, size + MLZ_CACHELINE_ALIGN-1);
+		MLZ_RET_FALSE(buf);
+
+		if (stream->buffer_unaligned)
+			mlz_dealloc(stream->params.allocator, stream->buffer_unaligned);
+		stream->buffer_unaligned = buf;
+		stream->buffer_size      = size;
+	}
+	buf = stream->buffer_unaligned;
+
+	/* sync groups are detected again */
+	if (stream->group_blocks) {
+		mlz_dealloc(stream->params.allocator, stream->group_blocks);
+		stream->group_blocks = MLZ_NULL;
+	}
+	stream->group_mode = MLZ_FALSE;
+
+	buf = (mlz_byte *)((mlz_uintptr)buf & ~((mlz_uintptr)MLZ_CACHELINE_ALIGN-1));
+	if (buf < stream->buffer_unaligned)
+		buf += MLZ_CACHELINE_ALIGN;
+
+	MLZ_ASSERT(buf >= stream->buffer_unaligned);
+	stream->buffer = buf;
+
+	stream->block_size    = block_size;
+	stream->block_reserve = reserve;
+	stream->slot_size     = block_size + reserve;
+	stream->context_size  = context_size;
+	stream->num_threads   = num_threads;
+	return MLZ_TRUE;
+}
+
+/* reset decoding state to start of stream (frame) */
+static void mlz_in_stream_restart(mlz_in_stream *stream)
+{
+	stream->ptr             = MLZ_NULL;
+	stream->top             = MLZ_NULL;
+	stream->checksum        = stream->params.initial_checksum;
+	stream->current_block   = 0;
+	stream->num_blocks      = 0;
+	stream->is_eof          = MLZ_FALSE;
+	stream->first_block     = MLZ_TRUE;
+	stream->first_cached    = MLZ_FALSE;
+	stream->next_block_size = 0;
+	stream->sync_cached     = MLZ_FALSE;
+	stream->seeked          = MLZ_FALSE;
+	stream->uoffset         = 0;
+}
+
+mlz_in_stream *
+mlz_in_stream_open(
+	MLZ_CONST mlz_stream_params *params
+)
+{
+	mlz_in_stream  *ins;
+	mlz_in_header   hdr;
+	mlz_byte        buf[MLZ_MAX_HEADER_SIZE];
+
+	/* params and read function test */
+	MLZ_RET_FALSE(params && params->read_func && params->read_ahead >= 0);
+
+	if (params->use_header)
+		MLZ_RET_FALSE(params->read_func(params->handle, buf, 2) == 2 &&
+			mlz_parse_header(buf, params->read_func, params->handle, &hdr));
+
+	ins = (mlz_in_stream *)mlz_alloc(params->allocator, sizeof(mlz_in_stream));
+	MLZ_RET_FALSE(ins);
+	memset(ins, 0, sizeof(mlz_in_stream));
+
+#if defined(MLZ_THREADS)
+	ins->mutex = mlz_mutex_create();
+	if (!ins->mutex) {
+		mlz_dealloc(params->allocator, ins);
+		return MLZ_NULL;
+	}
+	if (!mlz_batch_init(&ins->job_batch)) {
+		(void)mlz_mutex_destroy(ins->mutex);
+		mlz_dealloc(params->allocator, ins);
+		return MLZ_NULL;
+	}
+#endif
+
+	ins->params = *params;
+	/* only known from header */
+	ins->params.content_size = -1;
+	mlz_in_stream_derive_combine(ins);
+	if (params->use_header)
+		mlz_in_stream_apply_header(ins, &hdr);
+
+	if (!mlz_in_stream_alloc_buffer(ins)) {
+		ins->params.close_func = MLZ_NULL;
+		(void)mlz_in_stream_close(ins);
+		return MLZ_NULL;
+	}
+
+	ins->read_size = mlz_in_stream_read_size(params);
+	if (ins->read_size > 0) {
+		ins->read_buffer = (mlz_byte *)mlz_alloc(ins->params.allocator, ins->read_size);
+		if (!ins->read_buffer) {
+			ins->params.close_func = MLZ_NULL;
+			(void)mlz_in_stream_close(ins);
+			return MLZ_NULL;
+		}
+#if defined(MLZ_THREADS)
+		if (params->async_read && !mlz_in_stream_init_reader(ins)) {
+			ins->params.close_func = MLZ_NULL;
+			(void)mlz_in_stream_close(ins);
+			return MLZ_NULL;
+		}
+#endif
+	}
+
+	mlz_in_stream_restart(ins);
+	return ins;
+}
+
+/* refill read-ahead buffer, returns -1 on error, otherwise number of bytes read */
+static mlz_intptr mlz_in_stream_refill(mlz_in_stream *stream)
+{
+#if defined(MLZ_THREADS)
+	if (stream->reader) {
+		mlz_intptr nread;
+		mlz_byte  *tmp;
+
+		/* nothing in flight: first refill or input repositioned */
+		if (!stream->read_pending && !mlz_in_stream_read_async(stream))
+			return -1;
+
+		nread = mlz_in_stream_read_wait(stream);
+		if (nread <= 0)
+			return nread;
+
+		tmp                 = stream->read_buffer;
+		stream->read_buffer = stream->read_back;
+		stream->read_back   = tmp;
+
+		/* read next buffer while this one is being consumed */
+		return mlz_in_stream_read_async(stream) ? nread : -1;
+	}
+#endif
+	return stream->params.read_func(stream->params.handle, stream->read_buffer,
+		stream->read_size);
+}
+
+/* drop buffered data before repositioning input */
+static void mlz_in_stream_drop_buffer(mlz_in_stream *stream)
+{
+#if defined(MLZ_THREADS)
+	/* reader must be idle */
+	(void)mlz_in_stream_read_wait(stream);
+#endif
+	stream->read_pos = stream->read_top = 0;
+}
+
+/* buffered low level read, returns -1 on error, otherwise number of bytes read */
+/* (less than size only at end of input)                                      */
+static mlz_intptr mlz_in_stream_read_raw(mlz_in_stream *stream, void *buf, mlz_intptr size)
+{
+	mlz_byte  *dst   = (mlz_byte *)buf;
+	mlz_intptr total = 0;
+
+	if (stream->mem) {
+		if (size > stream->read_top - stream->read_pos)
+			size = stream->read_top - stream->read_pos;
+		memcpy(dst, stream->mem + stream->read_pos, size);
+		stream->read_pos += size;
+		return size;
+	}
+
+	if (!stream->read_buffer)
+		return stream->params.read_func(stream->params.handle, buf, size);
+
+	while (size > 0) {
+		mlz_intptr nread = stream->read_top - stream->read_pos;
+
+		if (nread > 0) {
+			/* serve from buffer */
+			if (nread > size)
+				nread = size;
+			memcpy(dst, stream->read_buffer + stream->read_pos, nread);
+			stream->read_pos += nread;
+		} else if (size >= stream->read_size && !mlz_in_stream_async_read(stream)) {
+			/* large read: bypass buffer */
+			nread = stream->params.read_func(stream->params.handle, dst, size);
+			if (nread < 0)
+				return -1;
+			if (!nread)
+				break;
+		} else {
+			/* refill */
+			nread = mlz_in_stream_refill(stream);
+			if (nread < 0)
+				return -1;
+			if (!nread)
+				break;
+			stream->read_pos = 0;
+			stream->read_top = nread;
+			continue;
+		}
+
+		dst   += nread;
+		size  -= nread;
+		total += nread;
+	}
+
+	return total;
+}
+
+/* load compressed block of given size; memory input maps it directly, */
+/* otherwise it's read to buf; returns MLZ_NULL on failure             */
+static MLZ_CONST mlz_byte *mlz_in_stream_load_block(mlz_in_stream *stream, mlz_byte *buf, mlz_intptr size,
+	mlz_bool map)
+{
+	MLZ_CONST mlz_byte *res = buf;
+
+	if (map && stream->mem) {
+		MLZ_RET_FALSE(size <= stream->read_top - stream->read_pos);
+		res = stream->mem + stream->read_pos;
+		stream->read_pos += size;
+
+		/* block checksum promises 8-byte aligned buffer: copy misaligned block */
+		if (((mlz_uintptr)res & 7) && (stream->params.block_checksum || stream->params.block_checksum64)) {
+			memcpy(buf, res, (size_t)size);
+			return buf;
+		}
+		return res;
+	}
+
+	MLZ_RET_FALSE(mlz_in_stream_read_raw(stream, buf, size) == size);
+	return res;
+}
+
+/* reposition input to absolute offset, negative offset is relative to end */
+static mlz_bool mlz_in_stream_seek_raw(mlz_in_stream *stream, mlz_long offset)
+{
+	if (stream->mem) {
+		if (offset < 0)
+			offset += stream->read_top;
+		MLZ_RET_FALSE(offset >= 0 && offset <= stream->read_top);
+		stream->read_pos = (mlz_intptr)offset;
+		return MLZ_TRUE;
+	}
+
+	MLZ_RET_FALSE(stream->params.seek_func);
+	mlz_in_stream_drop_buffer(stream);
+	return stream->params.seek_func(stream->params.handle, offset);
+}
+
+static mlz_bool mlz_read_little_endian(mlz_in_stream *stream, mlz_uint *val)
+{
+	mlz_byte buf[4];
+	MLZ_ASSERT(val);
+	MLZ_RET_FALSE(mlz_in_stream_read_raw(stream, buf, 4) == 4);
+	*val = mlz_load_little_endian(buf);
+	return MLZ_TRUE;
+}
+
+/* read_func-compatible wrapper of mlz_in_stream_read_raw */
+static mlz_intptr mlz_in_stream_raw_reader(void *handle, void *buf, mlz_intptr size)
+{
+	return mlz_in_stream_read_raw((mlz_in_stream *)handle, buf, size);
+}
+
+/* skip size bytes of input */
+static mlz_bool mlz_in_stream_skip(mlz_in_stream *stream, mlz_ulong size)
+{
+	mlz_byte buf[256];
+
+	while (size > 0) {
+		mlz_intptr to_skip = size > sizeof(buf) ? (mlz_intptr)sizeof(buf) : (mlz_intptr)size;
+		MLZ_RET_FALSE(mlz_in_stream_read_raw(stream, buf, to_skip) == to_skip);
+		size -= (mlz_ulong)to_skip;
+	}
+
+	return MLZ_TRUE;
+}
+
+/* look for next frame after end of stream, skipping block index trailer */
+/* sets frame_pending if found; end of input is not an error             */
+static mlz_bool mlz_in_stream_next_frame(mlz_in_stream *stream)
+{
+	mlz_byte buf[MLZ_MAX_HEADER_SIZE];
+
+	for (;;) {
+		mlz_intptr nread = mlz_in_stream_read_raw(stream, buf, 2);
+
+		if (!nread)
+			return MLZ_TRUE;
+
+		MLZ_RET_FALSE(nread == 2);
+
+		/* index trailer magic is never a valid header */
+		if (buf[0] != (MLZ_INDEX_MAGIC & 255) || buf[1] != ((MLZ_INDEX_MAGIC >> 8) & 255)) {
+			MLZ_RET_FALSE(mlz_parse_header(buf, mlz_in_stream_raw_reader, stream, &stream->next_header));
+			stream->frame_pending = MLZ_TRUE;
+			return MLZ_TRUE;
+		}
+
+		MLZ_RET_FALSE(mlz_in_stream_read_raw(stream, buf + 2, 6) == 6 &&
+			mlz_load_little_endian(buf) == MLZ_INDEX_MAGIC);
+		/* skip entries, checksum, trailer size and magic */
+		MLZ_RET_FALSE(mlz_in_stream_skip(stream, 16*(mlz_ulong)mlz_load_little_endian(buf + 4) + 12));
+	}
+}
+
+/* start decoding frame of next_header */
+static mlz_bool mlz_in_stream_switch_frame(mlz_in_stream *stream)
+{
+	mlz_int  block_size  = stream->params.block_size;
+	mlz_bool independent = stream->params.independent_blocks;
+
+	stream->frame_pending = MLZ_FALSE;
+	mlz_in_stream_apply_header(stream, &stream->next_header);
+
+	/* group buffers are sized for sync interval of previous frame */
+	if (stream->group_mode || block_size != stream->params.block_size ||
+			independent != stream->params.independent_blocks)
+		MLZ_RET_FALSE(mlz_in_stream_alloc_buffer(stream));
+
+	mlz_in_stream_restart(stream);
+	return MLZ_TRUE;
+}
+
+typedef struct
+{
+	/* compressed size, 0 = end of stream */
+	mlz_uint  size;
+	mlz_uint  usize;
+	/* compressed block checksum (32 or 64-bit) */
+	mlz_ulong checksum;
+	mlz_bool  partial;
+	mlz_bool  uncompressed;
+	mlz_bool  sync;
+} mlz_in_block_header;
+
+/* verify compressed block checksum (if any) */
+static mlz_bool mlz_in_stream_block_checksum_ok(mlz_in_stream *stream, MLZ_CONST void *buf,
+	size_t size, mlz_ulong checksum)
+{
+	if (stream->params.block_checksum64)
+		return stream->params.block_checksum64(buf, size) == checksum;
+
+	return !stream->params.block_checksum || stream->params.block_checksum(buf, size) == checksum;
+}
+
+static mlz_bool mlz_in_stream_valid_sync(mlz_in_stream *stream, mlz_uint sync_interval)
+{
+	MLZ_RET_FALSE(sync_interval > 0 &&
+		sync_interval <= (mlz_uint)(MLZ_MAX_BLOCK_SIZE/stream->block_size));
+	/* group buffers are sized for sync interval */
+	return !stream->group_mode || sync_interval == (mlz_uint)stream->sync_interval;
+}
+
+static mlz_bool mlz_in_stream_read_header(mlz_in_stream *stream, mlz_in_block_header *hdr)
+{
+	mlz_uint blk_size;
+
+	if (stream->next_block_size) {
+		blk_size = stream->next_block_size;
+		stream->next_block_size = 0;
+	} else {
+		MLZ_RET_FALSE(mlz_read_little_endian(stream, &blk_size));
+	}
+
+	hdr->partial      = (blk_size & MLZ_PARTIAL_BLOCK_MASK) != 0;
+	hdr->uncompressed = (blk_size & MLZ_UNCOMPRESSED_BLOCK_MASK) != 0;
+	hdr->sync         = (blk_size & MLZ_SYNC_BLOCK_MASK) != 0;
+
+	blk_size &= MLZ_BLOCK_LEN_MASK;
+
+	MLZ_RET_FALSE(blk_size <= (mlz_uint)stream->block_size);
+
+	hdr->size     = blk_size;
+	hdr->usize    = stream->block_size;
+	hdr->checksum = 0;
+
+	if (blk_size == 0)
+		return MLZ_TRUE;
+
+	/* load sync interval if needed */
+	if (hdr->sync) {
+		if (stream->sync_cached) {
+			stream->sync_cached = MLZ_FALSE;
+		} else {
+			mlz_uint sync_interval;
+			MLZ_RET_FALSE(mlz_read_little_endian(stream, &sync_interval) &&
+				mlz_in_stream_valid_sync(stream, sync_interval));
+			stream->sync_interval = (mlz_int)sync_interval;
+		}
+	}
+
+	/* load block checksum if needed */
+	if (stream->params.block_checksum64) {
+		mlz_uint lo, hi;
+		MLZ_RET_FALSE(mlz_read_little_endian(stream, &lo) && mlz_read_little_endian(stream, &hi));
+		hdr->checksum = ((mlz_ulong)hi << 32) | lo;
+	} else if (stream->params.block_checksum) {
+		mlz_uint checksum;
+		MLZ_RET_FALSE(mlz_read_little_endian(stream, &checksum));
+		hdr->checksum = checksum;
+	}
+
+	if (hdr->partial)
+		MLZ_RET_FALSE(mlz_read_little_endian(stream, &hdr->usize) &&
+			hdr->usize > 0 && hdr->usize <= (mlz_uint)stream->block_size);
+
+	/* uncompressed blocks are stored as is */
+	return !hdr->uncompressed || hdr->size == hdr->usize;
+}
+
+/* handle end of stream */
+static mlz_bool mlz_in_stream_finish(mlz_in_stream *stream)
+{
+	if (stream->params.incremental_checksum) {
+		mlz_uint checksum;
+		MLZ_RET_FALSE(mlz_read_little_endian(stream, &checksum));
+		MLZ_RET_FALSE(stream->params.unsafe || stream->seeked || checksum == stream->checksum);
+	}
+	/* validate content size if known */
+	MLZ_RET_FALSE(stream->params.content_size < 0 || stream->seeked ||
+		stream->uoffset == (mlz_ulong)stream->params.content_size);
+	/* concatenated stream: continue with next frame if any */
+	if (stream->params.multi_frame && stream->params.use_header) {
+		MLZ_RET_FALSE(mlz_in_stream_next_frame(stream));
+		if (stream->frame_pending)
+			return MLZ_TRUE;
+	}
+	stream->is_eof = MLZ_TRUE;
+	return MLZ_TRUE;
+}
+
+/* compute incremental checksum per block in parallel? */
+static mlz_bool mlz_in_stream_par_checksum(mlz_in_stream *stream)
+{
+	return stream->params.incremental_checksum && stream->params.combine_checksum;
+}
+
+/* uncompressed blocks only need a job to verify or compute checksum */
+static mlz_bool mlz_in_stream_block_job_needed(mlz_in_stream *stream, mlz_bool uncompressed)
+{
+	return !uncompressed || mlz_in_stream_par_checksum(stream) ||
+		(!stream->params.unsafe && (stream->params.block_checksum || stream->params.block_checksum64));
+}
+
+static void mlz_decompress_block_job(int thread, void *param)
+{
+	mlz_in_stream *stream = (mlz_in_stream *)param;
+
+	mlz_int blk_ofs  = thread * stream->slot_size;
+	MLZ_CONST mlz_byte *target = stream->block_targets[thread];
+	mlz_int blk_size = stream->blk_sizes[thread];
+	mlz_int usize    = stream->usizes[thread];
+	size_t dlen      = (size_t)usize;
+	mlz_uint checksum = 0;
+
+	/* validate compressed checksum */
+	if (!stream->params.unsafe &&
+			!mlz_in_stream_block_checksum_ok(stream, target, blk_size, stream->blk_checksums[thread]))
+		dlen = 0;
+	else if (!stream->unc_blocks[thread]) {
+		/* and finally: decompress (in-place) */
+		dlen = stream->params.unsafe ?
+			mlz_decompress_unsafe(stream->buffer + stream->context_size + blk_ofs, target,
+			blk_size)
+			: mlz_decompress(stream->buffer + stream->context_size + blk_ofs, usize, target,
+				blk_size, stream->context_size * (stream->first_block != MLZ_TRUE && stream->block_sync != MLZ_TRUE));
+	}
+
+	if (dlen == (size_t)usize && mlz_in_stream_par_checksum(stream))
+		checksum = stream->params.incremental_checksum(stream->buffer + stream->context_size + blk_ofs,
+			usize, stream->params.initial_checksum);
+
+#if defined(MLZ_THREADS)
+	(void)mlz_mutex_lock(stream->mutex);
+	stream->dlens[thread]     = dlen;
+	stream->checksums[thread] = checksum;
+	(void)mlz_mutex_unlock(stream->mutex);
+#else
+	stream->dlens[thread]     = dlen;
+	stream->checksums[thread] = checksum;
+#endif
+}
+
+#if defined(MLZ_THREADS)
+
+/* decompress whole sync group, blocks within group depend on each other */
+static void mlz_decompress_group_job(int thread, void *param)
+{
+	mlz_in_stream *stream = (mlz_in_stream *)param;
+
+	mlz_byte           *dst = stream->buffer + thread * stream->slot_size;
+	mlz_in_group_block *gb  = stream->group_blocks + thread * stream->sync_interval;
+	size_t              res = 0;
+	mlz_uint            checksum = 0;
+	mlz_int             i;
+
+	for (i=0; i<stream->group_counts[thread]; i++, gb++) {
+		/* validate compressed checksum */
+		if (!stream->params.unsafe &&
+				!mlz_in_stream_block_checksum_ok(stream, gb->target, gb->blk_size, gb->checksum))
+			break;
+		if (!gb->uncompressed) {
+			size_t dlen = stream->params.unsafe ?
+				mlz_decompress_unsafe(dst + gb->offset, gb->target, gb->blk_size)
+				: mlz_decompress(dst + gb->offset, gb->usize, gb->target, gb->blk_size, gb->offset);
+			if (dlen != (size_t)gb->usize)
+				break;
+		}
+		res += gb->usize;
+	}
+
+	if (res == (size_t)stream->usizes[thread] && mlz_in_stream_par_checksum(stream))
+		checksum = stream->params.incremental_checksum(dst, res, stream->params.initial_checksum);
+
+	(void)mlz_mutex_lock(stream->mutex);
+	stream->dlens[thread]     = res;
+	stream->checksums[thread] = checksum;
+	(void)mlz_mutex_unlock(stream->mutex);
+}
+
+/* largest sync group (uncompressed) decoded in parallel; sync interval */
+/* comes from the stream, larger groups are decoded serially so that   */
+/* a stream can't make us allocate group buffers of arbitrary size     */
+#define MLZ_MAX_GROUP_SIZE (1 << 22)
+
+/* switch to multi-threaded decompression of sync groups */
+static mlz_bool mlz_in_stream_init_groups(mlz_in_stream *stream, mlz_int sync_interval)
+{
+	mlz_byte *buf;
+	mlz_int   num_threads = 1 + stream->params.jobs->num_threads;
+	/* uncompressed group + compressed staging area */
+	mlz_int   slot_size   = 2*sync_interval*stream->block_size;
+
+	MLZ_ASSERT(sync_interval*stream->block_size <= MLZ_MAX_GROUP_SIZE);
+	MLZ_RET_FALSE((size_t)num_threads <= ((size_t)-1 >> 1)/
+		((size_t)slot_size + sizeof(mlz_in_group_block)*(size_t)sync_interval));
+
+	MLZ_RET_FALSE(mlz_in_stream_alloc_threads(stream, num_threads));
+
+	stream->group_blocks = (mlz_in_group_block *)mlz_alloc(stream->params.allocator,
+		sizeof(mlz_in_group_block)*(size_t)sync_interval*(size_t)num_threads);
+	MLZ_RET_FALSE(stream->group_blocks);
+
+	buf = (mlz_byte *)mlz_alloc(stream->params.allocator, (size_t)slot_size*num_threads + MLZ_CACHELINE_ALIGN-1);
+	if (!buf) {
+		mlz_dealloc(stream->params.allocator, stream->group_blocks);
+		stream->group_blocks = MLZ_NULL;
+		return MLZ_FALSE;
+	}
+
+	mlz_dealloc(stream->params.allocator, stream->buffer_unaligned);
+	stream->buffer_unaligned = buf;
+	stream->buffer_size      = (size_t)slot_size*num_threads;
+
+	buf = (mlz_byte *)((mlz_uintptr)buf & ~((mlz_uintptr)MLZ_CACHELINE_ALIGN-1));
+	if (buf < stream->buffer_unaligned)
+		buf += MLZ_CACHELINE_ALIGN;
+
+	stream->buffer        = buf;
+	/* groups start with sync block so no context is needed */
+	stream->context_size  = 0;
+	stream->slot_size     = slot_size;
+	stream->num_threads   = num_threads;
+	stream->sync_interval = sync_interval;
+	stream->group_mode    = MLZ_TRUE;
+	return MLZ_TRUE;
+}
+
+/* read and decompress up to num_threads sync groups in parallel */
+static mlz_bool
+mlz_in_stream_read_groups(mlz_in_stream *stream)
+{
+	mlz_in_block_header hdr;
+	mlz_int  i, j;
+	mlz_int  in_groups = 0;
+	mlz_bool eos       = MLZ_FALSE;
+
+	stream->current_block = 0;
+	stream->num_blocks    = 0;
+
+	for (i=0; i<stream->num_threads && !eos; i++) {
+		mlz_byte           *dst     = stream->buffer + i*stream->slot_size;
+		mlz_byte           *staging = dst + stream->sync_interval*stream->block_size;
+		mlz_in_group_block *gb      = stream->group_blocks + i*stream->sync_interval;
+		mlz_int             offset  = 0;
+
+		for (j=0; j<stream->sync_interval; j++, gb++) {
+			MLZ_RET_FALSE(mlz_in_stream_read_header(stream, &hdr));
+
+			if (hdr.size == 0) {
+				eos = MLZ_TRUE;
+				break;
+			}
+
+			/* each group starts with a sync block */
+			MLZ_RET_FALSE(hdr.sync == (j == 0));
+
+			gb->target       = mlz_in_stream_load_block(stream,
+				hdr.uncompressed ? dst + offset : staging + j*stream->block_size,
+				(mlz_intptr)hdr.size, !hdr.uncompressed);
+			gb->blk_size     = (mlz_int)hdr.size;
+			gb->usize        = (mlz_int)hdr.usize;
+			gb->offset       = offset;
+			gb->uncompressed = hdr.uncompressed;
+			gb->checksum     = hdr.checksum;
+
+			MLZ_RET_FALSE(gb->target);
+
+			offset += gb->usize;
+		}
+
+		if (!j)
+			break;
+
+		stream->group_counts[i] = j;
+		stream->usizes[i]       = offset;
+		in_groups++;
+	}
+
+	MLZ_RET_FALSE(mlz_jobs_prepare_batch_ex(stream->params.jobs, &stream->job_batch, in_groups > 1 ? in_groups-1 : 0));
+	for (i=1; i<in_groups; i++) {
+		mlz_job job;
+		job.param = stream;
+		job.job = mlz_decompress_group_job;
+		job.idx = i;
+		MLZ_RET_FALSE(mlz_jobs_enqueue_ex(stream->params.jobs, &stream->job_batch, job));
+	}
+	/* this thread helps too */
+	if (in_groups > 0)
+		mlz_decompress_group_job(0, stream);
+	MLZ_RET_FALSE(in_groups < 2 || mlz_jobs_wait_ex(stream->params.jobs, &stream->job_batch));
+
+	stream->ptr = stream->buffer;
+
+	for (i=0; i<in_groups; i++) {
+		/* handle decompression errors now */
+		MLZ_RET_FALSE(stream->dlens[i] == (size_t)stream->usizes[i]);
+		stream->uoffset += (mlz_ulong)stream->usizes[i];
+
+		/* compute incremental checksum if needed */
+		if (mlz_in_stream_par_checksum(stream))
+			stream->checksum =
+				stream->params.combine_checksum(stream->checksum, stream->checksums[i],
+					(size_t)stream->usizes[i]);
+		else if (stream->params.incremental_checksum)
+			stream->checksum =
+				stream->params.incremental_checksum(stream->buffer + i*stream->slot_size,
+					stream->usizes[i], stream->checksum);
+	}
+
+	stream->top = stream->ptr + (in_groups > 0 ? stream->usizes[0] : 0);
+
+	stream->first_cached = stream->first_block && !stream->seeked && !stream->frame;
+	stream->first_block  = MLZ_FALSE;
+
+	stream->num_blocks   = in_groups;
+
+	if (!eos) {
+		/* precache next block size to see if it's last block */
+		mlz_uint next_blk_size;
+		MLZ_RET_FALSE(mlz_read_little_endian(stream, &next_blk_size));
+		stream->next_block_size = next_blk_size;
+		eos = !(next_blk_size & MLZ_BLOCK_LEN_MASK);
+	}
+
+	if (eos) {
+		MLZ_RET_FALSE(mlz_in_stream_finish(stream));
+		if (in_groups == 0)
+			stream->ptr = stream->top = MLZ_NULL;
+	}
+
+	return MLZ_TRUE;
+}
+
+#endif
+
+static mlz_bool
+mlz_in_stream_read_block(mlz_in_stream *stream)
+{
+	mlz_in_block_header hdr;
+	mlz_uint  blk_size;
+	mlz_uint  usize;
+	mlz_int   i;
+	MLZ_CONST mlz_byte *target;
+	mlz_int   in_blocks = 0;
+	mlz_int   in_blocks_threaded = 0;
+
+	if (stream->frame_pending) {
+		MLZ_RET_FALSE(mlz_in_stream_switch_frame(stream));
+		stream->frame++;
+	}
+
+#if defined(MLZ_THREADS)
+	if (stream->first_block && !stream->group_mode && stream->params.jobs &&
+			!stream->params.independent_blocks) {
+		/* peek at first block: sync block means we can decompress groups in parallel */
+		mlz_uint first_blk_size, sync_interval;
+
+		MLZ_ASSERT(!stream->next_block_size);
+		MLZ_RET_FALSE(mlz_read_little_endian(stream, &first_blk_size));
+
+		if (!(first_blk_size & MLZ_BLOCK_LEN_MASK)) {
+			/* empty stream */
+			stream->current_block = 0;
+			stream->num_blocks    = 0;
+			stream->ptr = stream->top = MLZ_NULL;
+			return mlz_in_stream_finish(stream);
+		}
+
+		stream->next_block_size = first_blk_size;
+
+		if (first_blk_size & MLZ_SYNC_BLOCK_MASK) {
+			MLZ_RET_FALSE(mlz_read_little_endian(stream, &sync_interval) &&
+				mlz_in_stream_valid_sync(stream, sync_interval));
+			stream->sync_cached   = MLZ_TRUE;
+			stream->sync_interval = (mlz_int)sync_interval;
+
+			if (sync_interval <= (mlz_uint)(MLZ_MAX_GROUP_SIZE/stream->block_size))
+				MLZ_RET_FALSE(mlz_in_stream_init_groups(stream, (mlz_int)sync_interval));
+		}
+	}
+
+	if (stream->group_mode)
+		return mlz_in_stream_read_groups(stream);
+#endif
+
+	stream->current_block = 0;
+	stream->num_blocks    = 0;
+
+	blk_size = 0;
+	for (i=0; i<stream->num_threads; i++) {
+		mlz_int   target_pos;
+		mlz_int   blk_ofs = i*stream->slot_size;
+
+		MLZ_RET_FALSE(mlz_in_stream_read_header(stream, &hdr));
+
+		blk_size = hdr.size;
+
+		if (blk_size == 0)
+			break;
+
+		usize = hdr.usize;
+		/* only matters for dependent blocks (single slot) */
+		stream->block_sync = hdr.sync;
+
+		target_pos = stream->context_size + blk_ofs + stream->slot_size - blk_size;
+		/* make sure buffer is aligned, we have reserve anyway */
+		target_pos &= ~(mlz_uintptr)7;
+
+		if (hdr.uncompressed)
+			/* special handling of uncompressed blocks */
+			target_pos = stream->context_size + blk_ofs;
+
+		target = mlz_in_stream_load_block(stream, stream->buffer + target_pos, (mlz_intptr)blk_size,
+			!hdr.uncompressed);
+		MLZ_RET_FALSE(target);
+
+		stream->blk_sizes[in_blocks]       = blk_size;
+		stream->usizes[in_blocks]          = usize;
+		stream->unc_blocks[in_blocks]      = hdr.uncompressed;
+		stream->blk_checksums[in_blocks]   = hdr.checksum;
+		stream->dlens[in_blocks]           = usize;
+		stream->block_targets[in_blocks++] = target;
+
+		in_blocks_threaded += (i>0) && mlz_in_stream_block_job_needed(stream, hdr.uncompressed);
+	}
+
+	(void)in_blocks_threaded;
+#if defined(MLZ_THREADS)
+	MLZ_RET_FALSE(!stream->params.jobs || mlz_jobs_prepare_batch_ex(stream->params.jobs, &stream->job_batch, in_blocks_threaded));
+	for (i=1; i<in_blocks; i++) {
+		mlz_job job;
+		if (!mlz_in_stream_block_job_needed(stream, stream->unc_blocks[i]))
+			continue;
+		job.param = stream;
+		job.job = mlz_decompress_block_job;
+		job.idx = i;
+		MLZ_RET_FALSE(mlz_jobs_enqueue_ex(stream->params.jobs, &stream->job_batch, job));
+	}
+#endif
+	/* this thread helps too */
+	if (in_blocks > 0)
+		mlz_decompress_block_job(0, stream);
+#if defined(MLZ_THREADS)
+	MLZ_RET_FALSE(in_blocks < 2 || mlz_jobs_wait_ex(stream->params.jobs, &stream->job_batch));
+#endif
+
+	stream->ptr = stream->buffer + stream->context_size;
+
+	for (i=0; i<in_blocks; i++) {
+		mlz_int ofs = stream->slot_size*i;
+		usize = stream->usizes[i];
+
+		/* handle decompression (and block checksum) errors now */
+		if (stream->dlens[i] != (size_t)usize)
+			return MLZ_FALSE;
+		stream->uoffset += (mlz_ulong)usize;
+
+		/* compute incremental checksum if needed */
+		if (mlz_in_stream_par_checksum(stream))
+			stream->checksum =
+				stream->params.combine_checksum(stream->checksum, stream->checksums[i], usize);
+		else if (stream->params.incremental_checksum)
+			stream->checksum =
+				stream->params.incremental_checksum(stream->buffer + stream->context_size + ofs,
+					usize, stream->checksum);
+	}
+
+	usize = stream->usizes[0];
+	stream->top = stream->ptr + usize;
+
+	/* copy context, short (flushed) block slides it */
+	if (stream->context_size > 0)
+		memmove(stream->buffer, stream->buffer + usize, stream->context_size);
+
+	stream->first_cached = stream->first_block && !stream->seeked && !stream->frame;
+	stream->first_block  = MLZ_FALSE;
+
+	stream->num_blocks   = in_blocks;
 
 	if (blk_size) {
 		/* precache next block size to see if it's last block, this is important for checksum verification */
@@ -450,20 +1837,624 @@ mlz_in_stream_read_block(mlz_in_stream *stream)
 			blk_size = 0;
 	}
 
-	if (blk_size == 0) {
-		if (!stream->params.unsafe && stream->params.incremental_checksum) {
-			mlz_uint checksum;
-			MLZ_RET_FALSE(mlz_read_little_endian(stream, &checksum) &&
-				checksum == stream->checksum);
+	if (blk_size == 0) {
+		MLZ_RET_FALSE(mlz_in_stream_finish(stream));
+		if (in_blocks == 0)
+			stream->ptr = stream->top = MLZ_NULL;
+	}
+
+	return MLZ_TRUE;
+}
+
+/* make sure decoded data is available at stream->ptr unless EOF */
+/* returns MLZ_FALSE on error                                      */
+static mlz_bool
+mlz_in_stream_advance(mlz_in_stream *stream)
+{
+	while (stream->ptr >= stream->top) {
+		if (stream->current_block+1 < stream->num_blocks) {
+			/* jump to next block */
+			++stream->current_block;
+			stream->ptr = stream->buffer + stream->context_size +
+				stream->current_block * stream->slot_size;
+			stream->top = stream->ptr + stream->usizes[stream->current_block];
+			continue;
+		}
+		if (stream->is_eof)
+			break;
+
+		/* read next block */
+		MLZ_RET_FALSE(mlz_in_stream_read_block(stream));
+	}
+
+	return MLZ_TRUE;
+}
+
+/* memory source, used to parse header of memory input */
+typedef struct
+{
+	MLZ_CONST mlz_byte *data;
+	size_t              size;
+	size_t              pos;
+} mlz_mem_source;
+
+static mlz_intptr mlz_mem_read(void *handle, void *buf, mlz_intptr size)
+{
+	mlz_mem_source *src = (mlz_mem_source *)handle;
+
+	if ((size_t)size > src->size - src->pos)
+		size = (mlz_intptr)(src->size - src->pos);
+
+	memcpy(buf, src->data + src->pos, size);
+	src->pos += (size_t)size;
+	return size;
+}
+
+mlz_in_stream *
+mlz_in_stream_open_memory(
+	MLZ_CONST mlz_stream_params *params,
+	MLZ_CONST void              *data,
+	size_t                       size
+)
+{
+	mlz_stream_params par;
+	mlz_mem_source    src;
+	mlz_in_stream    *ins;
+
+	MLZ_RET_FALSE(params && data);
+
+	src.data = (MLZ_CONST mlz_byte *)data;
+	src.size = size;
+	src.pos  = 0;
+
+	par            = *params;
+	par.handle     = &src;
+	par.read_func  = mlz_mem_read;
+	par.read_ahead = 0;
+
+	ins = mlz_in_stream_open(&par);
+	MLZ_RET_FALSE(ins);
+
+	/* switch to memory input */
+	ins->params.handle    = params->handle;
+	ins->params.read_func = params->read_func;
+	ins->mem              = src.data;
+	ins->read_pos         = (mlz_intptr)src.pos;
+	ins->read_top         = (mlz_intptr)size;
+	return ins;
+}
+
+/* start new stream on existing one, data != MLZ_NULL: memory input */
+static mlz_bool mlz_in_stream_reinit(mlz_in_stream *stream, MLZ_CONST mlz_stream_params *params,
+	MLZ_CONST void *data, size_t size)
+{
+	mlz_in_header hdr;
+	mlz_byte      buf[MLZ_MAX_HEADER_SIZE];
+	mlz_intptr    read_size = mlz_in_stream_read_size(params);
+
+	/* stream memory was allocated using this allocator */
+	MLZ_RET_FALSE(params->allocator == stream->params.allocator);
+
+	/* note: read-ahead buffer and reader are kept in memory mode, */
+	/* unused until reset to read_func input                       */
+#if defined(MLZ_THREADS)
+	/* reader may still be using old handle */
+	mlz_in_stream_drop_buffer(stream);
+	if (!params->async_read || read_size != stream->read_size)
+		MLZ_RET_FALSE(mlz_in_stream_stop_reader(stream));
+#endif
+
+	if (stream->params.close_func) {
+		mlz_bool (*close_func)(void *handle) = stream->params.close_func;
+		stream->params.close_func = MLZ_NULL;
+		MLZ_RET_FALSE(close_func(stream->params.handle));
+	}
+
+	if (read_size != stream->read_size) {
+		if (stream->read_buffer) {
+			mlz_dealloc(stream->params.allocator, stream->read_buffer);
+			stream->read_buffer = MLZ_NULL;
 		}
-		stream->is_eof = MLZ_TRUE;
-		if (in_blocks == 0)
-			stream->ptr = stream->top = MLZ_NULL;
+		stream->read_size = 0;
+		if (read_size > 0) {
+			stream->read_buffer = (mlz_byte *)mlz_alloc(stream->params.allocator, read_size);
+			MLZ_RET_FALSE(stream->read_buffer);
+		}
+		stream->read_size = read_size;
+	}
+
+	/* index is loaded again on first seek */
+	if (stream->index) {
+		mlz_dealloc(stream->params.allocator, stream->index);
+		stream->index = MLZ_NULL;
+	}
+	stream->index_size   = 0;
+	stream->index_loaded = MLZ_FALSE;
+
+	stream->params = *params;
+	/* only known from header */
+	stream->params.content_size = -1;
+	mlz_in_stream_derive_combine(stream);
+	stream->header_size   = 0;
+	stream->frame         = 0;
+	stream->frame_pending = MLZ_FALSE;
+	stream->mem           = (MLZ_CONST mlz_byte *)data;
+	stream->read_pos      = 0;
+	stream->read_top      = data ? (mlz_intptr)size : 0;
+
+#if defined(MLZ_THREADS)
+	if (!data && read_size > 0 && params->async_read && !stream->reader)
+		MLZ_RET_FALSE(mlz_in_stream_init_reader(stream));
+#endif
+
+	if (params->use_header) {
+		MLZ_RET_FALSE(mlz_in_stream_read_raw(stream, buf, 2) == 2 &&
+			mlz_parse_header(buf, mlz_in_stream_raw_reader, stream, &hdr));
+		mlz_in_stream_apply_header(stream, &hdr);
+	}
+
+	MLZ_RET_FALSE(mlz_in_stream_alloc_buffer(stream));
+	mlz_in_stream_restart(stream);
+	return MLZ_TRUE;
+}
+
+mlz_bool
+mlz_in_stream_reset(
+	mlz_in_stream               *stream,
+	MLZ_CONST mlz_stream_params *params
+)
+{
+	MLZ_RET_FALSE(stream);
+
+	if (!params || !params->read_func || params->read_ahead < 0 ||
+			!mlz_in_stream_reinit(stream, params, MLZ_NULL, 0)) {
+		(void)mlz_in_stream_close(stream);
+		return MLZ_FALSE;
 	}
 
 	return MLZ_TRUE;
 }
 
+mlz_bool
+mlz_in_stream_reset_memory(
+	mlz_in_stream               *stream,
+	MLZ_CONST mlz_stream_params *params,
+	MLZ_CONST void              *data,
+	size_t                       size
+)
+{
+	MLZ_RET_FALSE(stream);
+
+	if (!params || !data || params->read_ahead < 0 ||
+			!mlz_in_stream_reinit(stream, params, data, size)) {
+		(void)mlz_in_stream_close(stream);
+		return MLZ_FALSE;
+	}
+
+	return MLZ_TRUE;
+}
+
+/* walk stream (frame) in memory without decoding; returns compressed size */
+/* of frame (including block index) or 0 on error, adds uncompressed size  */
+static size_t mlz_walk_frame(MLZ_CONST mlz_byte *data, size_t size, mlz_ulong *usize)
+{
+	mlz_in_header  hdr;
+	mlz_mem_source src;
+	mlz_byte       buf[MLZ_MAX_HEADER_SIZE];
+	size_t         pos;
+
+	MLZ_RET_FALSE(size >= 2);
+	buf[0] = data[0];
+	buf[1] = data[1];
+
+	src.data = data;
+	src.size = size;
+	src.pos  = 2;
+	MLZ_RET_FALSE(mlz_parse_header(buf, mlz_mem_read, &src, &hdr));
+
+	for (pos = src.pos;;) {
+		mlz_uint blk_size, blk_usize = (mlz_uint)hdr.block_size;
+
+		MLZ_RET_FALSE(size - pos >= 4);
+		blk_size = mlz_load_little_endian(data + pos);
+		pos += 4;
+
+		if (!(blk_size & MLZ_BLOCK_LEN_MASK))
+			break;
+
+		/* sync interval, block checksum (32 or 64-bit) */
+		pos += 4*((blk_size & MLZ_SYNC_BLOCK_MASK) != 0) +
+			(hdr.block_checksum->block_checksum64 ? 8 : 4)*((hdr.flags & 0x40) != 0);
+
+		if (blk_size & MLZ_PARTIAL_BLOCK_MASK) {
+			MLZ_RET_FALSE(pos <= size && size - pos >= 4);
+			blk_usize = mlz_load_little_endian(data + pos);
+			pos += 4;
+			MLZ_RET_FALSE(blk_usize > 0 && blk_usize <= (mlz_uint)hdr.block_size);
+		}
+
+		blk_size &= MLZ_BLOCK_LEN_MASK;
+		MLZ_RET_FALSE(blk_size <= (mlz_uint)hdr.block_size && pos <= size && size - pos >= blk_size);
+		pos    += blk_size;
+		*usize += blk_usize;
+	}
+
+	/* incremental checksum */
+	if (hdr.flags & 0x80)
+		pos += 4;
+	MLZ_RET_FALSE(pos <= size);
+
+	/* block index trailer */
+	if (size - pos >= 8 && mlz_load_little_endian(data + pos) == MLZ_INDEX_MAGIC) {
+		mlz_ulong trailer_size = 5*4 + 16*(mlz_ulong)mlz_load_little_endian(data + pos + 4);
+		MLZ_RET_FALSE(trailer_size <= size - pos);
+		pos += (size_t)trailer_size;
+	}
+
+	return pos;
+}
+
+mlz_intptr
+mlz_scan_frames(
+	MLZ_CONST void *data,
+	size_t          size,
+	mlz_ulong      *usize
+)
+{
+	MLZ_CONST mlz_byte *src = (MLZ_CONST mlz_byte *)data;
+	mlz_ulong  total = 0;
+	mlz_intptr count = 0;
+	size_t     pos   = 0;
+
+	if (!data)
+		return -1;
+
+	while (pos < size) {
+		size_t frame_size = mlz_walk_frame(src + pos, size - pos, &total);
+		if (!frame_size)
+			return -1;
+		pos += frame_size;
+		count++;
+	}
+
+	if (usize)
+		*usize = total;
+
+	return count;
+}
+
+size_t
+mlz_scan_frame(
+	MLZ_CONST void *data,
+	size_t          size,
+	mlz_ulong      *usize
+)
+{
+	mlz_ulong total = 0;
+	size_t    res;
+
+	if (!data)
+		return 0;
+
+	res = mlz_walk_frame((MLZ_CONST mlz_byte *)data, size, &total);
+	if (res && usize)
+		*usize += total;
+
+	return res;
+}
+
+/* frame decoded by a job */
+typedef struct
+{
+	MLZ_CONST mlz_byte *src;
+	size_t              size;
+	mlz_byte           *dst;
+	mlz_ulong           usize;
+	mlz_bool            ok;
+} mlz_frame_job;
+
+typedef struct
+{
+	mlz_stream_params   params;
+	mlz_frame_job      *frames;
+} mlz_frame_batch;
+
+static mlz_bool mlz_decompress_frame(MLZ_CONST mlz_stream_params *params, mlz_frame_job *frame)
+{
+	mlz_in_stream *ins = mlz_in_stream_open_memory(params, frame->src, frame->size);
+	mlz_byte       extra;
+	mlz_bool       res;
+
+	MLZ_RET_FALSE(ins);
+
+	/* whole frame must decode, including checksum at end */
+	res = mlz_stream_read(ins, frame->dst, (mlz_intptr)frame->usize) == (mlz_intptr)frame->usize &&
+		mlz_stream_read(ins, &extra, 1) == 0 && mlz_in_stream_eof(ins);
+
+	return mlz_in_stream_close(ins) && res;
+}
+
+static void mlz_decompress_frame_job(int thread, void *param)
+{
+	mlz_frame_batch *batch = (mlz_frame_batch *)param;
+	mlz_frame_job   *frame = batch->frames + thread;
+
+	frame->ok = mlz_decompress_frame(&batch->params, frame);
+}
+
+mlz_intptr
+mlz_decompress_frames(
+	MLZ_CONST mlz_stream_params *params,
+	MLZ_CONST void              *src,
+	size_t                       src_size,
+	void                        *dst,
+	size_t                       dst_size
+)
+{
+	mlz_frame_batch batch;
+	mlz_intptr      i, count;
+	mlz_ulong       total = 0;
+	size_t          pos   = 0;
+	mlz_ulong       upos  = 0;
+	mlz_bool        res   = MLZ_TRUE;
+
+	if (!params)
+		return -1;
+
+	count = mlz_scan_frames(src, src_size, &total);
+	if (count < 0 || total > (mlz_ulong)dst_size || total > (mlz_ulong)((~(size_t)0) >> 1) || (total && !dst))
+		return -1;
+
+	if (!count)
+		return 0;
+
+	batch.frames = (mlz_frame_job *)mlz_alloc(params->allocator, sizeof(mlz_frame_job)*(size_t)count);
+	if (!batch.frames)
+		return -1;
+
+	for (i=0; i<count; i++) {
+		mlz_frame_job *frame = batch.frames + i;
+
+		frame->usize = 0;
+		frame->src   = (MLZ_CONST mlz_byte *)src + pos;
+		frame->size  = mlz_walk_frame(frame->src, src_size - pos, &frame->usize);
+		frame->dst   = (mlz_byte *)dst + upos;
+		frame->ok    = MLZ_FALSE;
+
+		pos  += frame->size;
+		upos += frame->usize;
+	}
+
+	/* frames are decoded one per job; single frame uses jobs itself */
+	batch.params            = mlz_default_stream_params;
+	batch.params.unsafe     = params->unsafe;
+	batch.params.read_ahead = 0;
+	batch.params.close_func = MLZ_NULL;
+	batch.params.allocator  = params->allocator;
+	batch.params.jobs       = count > 1 ? MLZ_NULL : params->jobs;
+
+#if defined(MLZ_THREADS)
+	/* all frames at once, workers balance uneven frames by stealing */
+	if (params->jobs && count > 1) {
+		mlz_batch jobs_batch;
+
+		res = mlz_batch_init(&jobs_batch) &&
+			mlz_jobs_prepare_batch_ex(params->jobs, &jobs_batch, (mlz_int)(count-1));
+		for (i=1; res && i<count; i++) {
+			mlz_job job;
+			job.job   = mlz_decompress_frame_job;
+			job.param = &batch;
+			job.idx   = (int)i;
+			res = mlz_jobs_enqueue_ex(params->jobs, &jobs_batch, job);
+		}
+		/* this thread helps too */
+		if (res)
+			mlz_decompress_frame_job(0, &batch);
+		res = mlz_jobs_wait_ex(params->jobs, &jobs_batch) && res;
+		res = mlz_batch_destroy(&jobs_batch) && res;
+	} else
+#endif
+	for (i=0; i<count; i++)
+		mlz_decompress_frame_job((int)i, &batch);
+
+	for (i=0; res && i<count; i++)
+		res = batch.frames[i].ok;
+
+	mlz_dealloc(params->allocator, batch.frames);
+	return res ? (mlz_intptr)total : -1;
+}
+
+mlz_intptr
+mlz_decompress_parallel_size(
+	MLZ_CONST void *src,
+	size_t          src_size
+)
+{
+	MLZ_CONST mlz_byte *sb = (MLZ_CONST mlz_byte *)src;
+
+	if (!sb || src_size < MLZ_SEGMENTED_HEADER_SIZE || mlz_load_little_endian(sb) != MLZ_SEGMENTED_MAGIC)
+		return -1;
+
+	return (mlz_intptr)mlz_load_little_endian(sb + 4);
+}
+
+/* segments being decoded by mlz_decompress_parallel */
+typedef struct
+{
+	MLZ_CONST mlz_byte *src;
+	mlz_byte           *dst;
+	size_t              dst_size;
+	size_t              segment_size;
+	/* decode segments (independent) or only checksum them */
+	mlz_bool            decode;
+	/* per segment: offset in src, compressed size (mask = stored), */
+	/* decoded ok, adler32                                          */
+	size_t             *offsets;
+	mlz_uint           *sizes;
+	mlz_bool           *ok;
+	mlz_uint           *checksums;
+} mlz_segment_dec_batch;
+
+/* decode segment with context bytes preceding it */
+static mlz_bool mlz_decompress_segment(mlz_segment_dec_batch *batch, size_t idx, size_t context)
+{
+	size_t    offset = idx*batch->segment_size;
+	size_t    usize  = batch->dst_size - offset;
+	size_t    csize  = batch->sizes[idx] & ~(mlz_uint)MLZ_UNCOMPRESSED_BLOCK_MASK;
+	mlz_byte *dst    = batch->dst + offset;
+
+	if (usize > batch->segment_size)
+		usize = batch->segment_size;
+
+	if (batch->sizes[idx] & MLZ_UNCOMPRESSED_BLOCK_MASK) {
+		memcpy(dst, batch->src + batch->offsets[idx], usize);
+		return MLZ_TRUE;
+	}
+
+	if (context > offset)
+		context = offset;
+
+	return mlz_decompress(dst, usize, batch->src + batch->offsets[idx], csize, context) == usize;
+}
+
+static void mlz_decompress_segment_job(int idx, void *param)
+{
+	mlz_segment_dec_batch *batch  = (mlz_segment_dec_batch *)param;
+	size_t                 offset = (size_t)idx*batch->segment_size;
+	size_t                 usize  = batch->dst_size - offset;
+
+	if (usize > batch->segment_size)
+		usize = batch->segment_size;
+
+	if (batch->decode)
+		batch->ok[idx] = mlz_decompress_segment(batch, (size_t)idx, 0);
+
+	if (batch->ok[idx])
+		batch->checksums[idx] = mlz_adler32(batch->dst + offset, usize, 1);
+}
+
+mlz_intptr
+mlz_decompress_parallel(
+	void            *dst,
+	size_t           dst_size,
+	MLZ_CONST void  *src,
+	size_t           src_size,
+	struct mlz_jobs *jobs
+)
+{
+	return mlz_decompress_parallel_ex(dst, dst_size, src, src_size, jobs, MLZ_NULL);
+}
+
+mlz_intptr
+mlz_decompress_parallel_ex(
+	void                    *dst,
+	size_t                   dst_size,
+	MLZ_CONST void          *src,
+	size_t                   src_size,
+	struct mlz_jobs         *jobs,
+	MLZ_CONST mlz_allocator *allocator
+)
+{
+	mlz_segment_dec_batch batch;
+	MLZ_CONST mlz_byte   *sb       = (MLZ_CONST mlz_byte *)src;
+	mlz_intptr            usize    = mlz_decompress_parallel_size(src, src_size);
+	size_t                i, count, pos, context;
+	mlz_uint              checksum = 1;
+	mlz_bool              res      = MLZ_TRUE;
+
+	if (usize < 0 || (size_t)usize > dst_size || (!dst && usize))
+		return -1;
+
+	batch.src          = sb;
+	batch.dst          = (mlz_byte *)dst;
+	batch.dst_size     = (size_t)usize;
+	batch.segment_size = mlz_load_little_endian(sb + 12);
+	context            = mlz_load_little_endian(sb + 16);
+	batch.decode       = !context;
+
+	if (batch.segment_size < 1 || batch.segment_size >= MLZ_MAX_BLOCK_SIZE)
+		return -1;
+
+	count = batch.dst_size/batch.segment_size + (batch.dst_size % batch.segment_size != 0);
+
+	/* segment table must fit in src (bounds count before sizes are computed) */
+	if (count > (src_size - MLZ_SEGMENTED_HEADER_SIZE)/4 ||
+			count > ((size_t)-1)/(sizeof(size_t) + 2*sizeof(mlz_uint) + sizeof(mlz_bool)))
+		return -1;
+
+	pos = MLZ_SEGMENTED_HEADER_SIZE + 4*count;
+
+	batch.offsets = (size_t *)mlz_alloc(allocator, (sizeof(size_t) + 2*sizeof(mlz_uint) + sizeof(mlz_bool))*(count ? count : 1));
+	if (!batch.offsets)
+		return -1;
+
+	batch.sizes     = (mlz_uint *)(batch.offsets + count);
+	batch.checksums = batch.sizes + count;
+	batch.ok        = (mlz_bool *)(batch.checksums + count);
+
+	/* validate segment table before any segment is decoded */
+	for (i=0; res && i<count; i++) {
+		size_t size, seg_usize = batch.dst_size - i*batch.segment_size;
+
+		if (seg_usize > batch.segment_size)
+			seg_usize = batch.segment_size;
+
+		batch.sizes[i]   = mlz_load_little_endian(sb + MLZ_SEGMENTED_HEADER_SIZE + 4*i);
+		batch.offsets[i] = pos;
+		batch.ok[i]      = MLZ_TRUE;
+		size             = batch.sizes[i] & ~(mlz_uint)MLZ_UNCOMPRESSED_BLOCK_MASK;
+
+		res  = size <= src_size - pos &&
+			(!(batch.sizes[i] & MLZ_UNCOMPRESSED_BLOCK_MASK) || size == seg_usize);
+		pos += size;
+	}
+
+	/* segments seeded with context depend on previous ones: decode */
+	/* them here, jobs then only verify checksums                  */
+	for (i=0; res && !batch.decode && i<count; i++)
+		res = mlz_decompress_segment(&batch, i, context);
+
+#if defined(MLZ_THREADS)
+	if (res && jobs && count > 1) {
+		mlz_batch jobs_batch;
+
+		res = mlz_batch_init(&jobs_batch) &&
+			mlz_jobs_prepare_batch_ex(jobs, &jobs_batch, (mlz_int)(count-1));
+		for (i=1; res && i<count; i++) {
+			mlz_job job;
+			job.job   = mlz_decompress_segment_job;
+			job.param = &batch;
+			job.idx   = (int)i;
+			res = mlz_jobs_enqueue_ex(jobs, &jobs_batch, job);
+		}
+		/* this thread helps too */
+		if (res)
+			mlz_decompress_segment_job(0, &batch);
+		res = mlz_jobs_wait_ex(jobs, &jobs_batch) && res;
+		res = mlz_batch_destroy(&jobs_batch) && res;
+	} else
+#else
+	(void)jobs;
+#endif
+	for (i=0; res && i<count; i++)
+		mlz_decompress_segment_job((int)i, &batch);
+
+	for (i=0; res && i<count; i++) {
+		size_t seg_usize = batch.dst_size - i*batch.segment_size;
+
+		if (seg_usize > batch.segment_size)
+			seg_usize = batch.segment_size;
+
+		res = batch.ok[i];
+		if (res)
+			checksum = mlz_adler32_combine(checksum, batch.checksums[i], seg_usize);
+	}
+
+	mlz_dealloc(allocator, batch.offsets);
+
+	return res && checksum == mlz_load_little_endian(sb + 8) ? usize : -1;
+}
+
 mlz_intptr
 mlz_stream_read(
 	mlz_in_stream *stream,
@@ -479,70 +2470,244 @@ mlz_stream_read(
 	while (size > 0) {
 		mlz_intptr to_fill, capacity;
 
-		if (stream->ptr >= stream->top) {
-			if (++stream->current_block < stream->num_blocks) {
-				/* jump to next block */
-				stream->ptr = stream->buffer + stream->context_size +
-					stream->current_block * (stream->block_size + stream->block_reserve);
-				stream->top = stream->ptr + stream->usizes[stream->current_block];
-				continue;
-			}
-			if (stream->is_eof)
-				break;
+		if (!mlz_in_stream_advance(stream))
+			return -1;
 
-			/* read next block */
-			if (!mlz_in_stream_read_block(stream))
-				return -1;
-		}
+		if (stream->ptr >= stream->top)
+			break;
 
 		to_fill = size;
 		capacity = (mlz_intptr)(stream->top - stream->ptr);
 		if (to_fill > capacity)
 			to_fill = capacity;
 
-		if (to_fill > 0) {
-			if (db) {
-				memcpy(db, stream->ptr, to_fill);
-				db += to_fill;
-			}
-			stream->ptr += to_fill;
-			size        -= to_fill;
-			nread       += to_fill;
+		if (db) {
+			memcpy(db, stream->ptr, to_fill);
+			db += to_fill;
 		}
+		stream->ptr += to_fill;
+		size        -= to_fill;
+		nread       += to_fill;
 	}
 
 	return nread;
 }
 
+mlz_bool
+mlz_in_stream_peek(
+	mlz_in_stream       *stream,
+	MLZ_CONST void     **ptr,
+	mlz_intptr          *size
+)
+{
+	MLZ_RET_FALSE(stream && ptr && size);
+	MLZ_RET_FALSE(mlz_in_stream_advance(stream));
+
+	if (stream->ptr >= stream->top) {
+		/* EOF */
+		*ptr  = MLZ_NULL;
+		*size = 0;
+		return MLZ_TRUE;
+	}
+
+	*ptr  = stream->ptr;
+	*size = (mlz_intptr)(stream->top - stream->ptr);
+	return MLZ_TRUE;
+}
+
+mlz_bool
+mlz_in_stream_consume(
+	mlz_in_stream *stream,
+	mlz_intptr     size
+)
+{
+	MLZ_RET_FALSE(stream && size >= 0);
+
+	if (!size)
+		return MLZ_TRUE;
+
+	MLZ_RET_FALSE(stream->ptr && size <= (mlz_intptr)(stream->top - stream->ptr));
+	stream->ptr += size;
+	return MLZ_TRUE;
+}
+
 mlz_bool
 mlz_in_stream_rewind(
 	mlz_in_stream *stream
 )
 {
-	mlz_byte hdr[2];
+	mlz_byte hdr[MLZ_MAX_HEADER_SIZE];
 
 	MLZ_RET_FALSE(stream);
 
 	if (stream->first_cached) {
 		/* fast rewind */
 		stream->ptr           = stream->buffer + stream->context_size;
+		stream->top           = stream->ptr + (stream->num_blocks > 0 ? stream->usizes[0] : 0);
 		stream->current_block = 0;
 		return MLZ_TRUE;
 	}
 
-	MLZ_RET_FALSE(stream->params.rewind_func && stream->params.rewind_func(stream->params.handle));
+	if (stream->mem) {
+		stream->read_pos = 0;
+	} else {
+		MLZ_RET_FALSE(stream->params.rewind_func);
+		mlz_in_stream_drop_buffer(stream);
+		MLZ_RET_FALSE(stream->params.rewind_func(stream->params.handle));
+	}
 
-	stream->ptr             = MLZ_NULL;
-	stream->top             = MLZ_NULL;
-	stream->checksum        = stream->params.initial_checksum;
-	stream->is_eof          = MLZ_FALSE;
-	stream->first_block     = MLZ_TRUE;
-	stream->first_cached    = MLZ_FALSE;
-	stream->next_block_size = 0;
+	mlz_in_stream_restart(stream);
+	stream->frame_pending = MLZ_FALSE;
+
+	if (stream->frame > 0) {
+		/* back to first frame of concatenated stream */
+		stream->frame = 0;
+		MLZ_RET_FALSE(mlz_in_stream_read_raw(stream, hdr, 2) == 2 &&
+			mlz_parse_header(hdr, mlz_in_stream_raw_reader, stream, &stream->next_header));
+		return mlz_in_stream_switch_frame(stream);
+	}
 
 	/* skip header if necessary */
-	return stream->params.use_header ?
-		stream->params.read_func(stream->params.handle, hdr, 2) == 2 : MLZ_TRUE;
+	return !stream->header_size ||
+		mlz_in_stream_read_raw(stream, hdr, stream->header_size) == stream->header_size;
+}
+
+/* load block index trailer (see mlz_stream_enc.c) */
+static mlz_bool mlz_in_stream_load_index(mlz_in_stream *stream)
+{
+	mlz_byte *buf;
+	mlz_byte  tail[12];
+	mlz_uint  size, count = 0;
+	mlz_bool  res;
+
+	stream->index_loaded = MLZ_TRUE;
+	/* file position changes: no fast rewind */
+	stream->first_cached = MLZ_FALSE;
+
+	MLZ_RET_FALSE(mlz_in_stream_seek_raw(stream, -8) &&
+		mlz_in_stream_read_raw(stream, tail, 8) == 8);
+
+	size = mlz_load_little_endian(tail);
+	MLZ_RET_FALSE(mlz_load_little_endian(tail+4) == MLZ_INDEX_MAGIC &&
+		size >= 5*4 && !((size - 5*4) & 15));
+
+	buf = (mlz_byte *)mlz_alloc(stream->params.allocator, size);
+	MLZ_RET_FALSE(buf);
+
+	res = mlz_in_stream_seek_raw(stream, -(mlz_long)size) &&
+		mlz_in_stream_read_raw(stream, buf, (mlz_intptr)size) == (mlz_intptr)size &&
+		mlz_load_little_endian(buf) == MLZ_INDEX_MAGIC;
+
+	if (res) {
+		count = mlz_load_little_endian(buf + 4);
+		res = count > 0 && count == (size - 5*4)/16 &&
+			mlz_adler32(buf + 8, 16*count, 1) == mlz_load_little_endian(buf + 8 + 16*count);
+	}
+
+	if (res) {
+		stream->index = (mlz_ulong *)mlz_alloc(stream->params.allocator, sizeof(mlz_ulong)*2*count);
+		res = stream->index != MLZ_NULL;
+	}
+
+	if (res) {
+		mlz_uint i;
+		for (i=0; i<2*count; i++)
+			stream->index[i] = mlz_load_little_endian64(buf + 8 + 8*i);
+		stream->index_size = (mlz_int)count;
+
+		/* end of stream is followed by terminator, checksum and trailer */
+		stream->index_end = stream->index[2*count-2] + 4 + size +
+			4*(stream->params.incremental_checksum != MLZ_NULL);
+
+		/* seek points must lie within stream */
+		for (i=0; res && i<count; i++)
+			res = stream->index[2*i] <= stream->index[2*count-2] &&
+				stream->index[2*i+1] <= stream->index[2*count-1];
+	}
+
+	mlz_dealloc(stream->params.allocator, buf);
+
+	if (!res && stream->index) {
+		mlz_dealloc(stream->params.allocator, stream->index);
+		stream->index      = MLZ_NULL;
+		stream->index_size = 0;
+	}
+
+	if (res && stream->params.multi_frame) {
+		/* concatenated stream: index only usable if it belongs to first (only) frame, */
+		/* i.e. its end of stream (at absolute offset, first frame starts at 0) is  */
+		/* followed by (checksum and) the trailer                                 */
+		res = mlz_in_stream_seek_raw(stream, (mlz_long)stream->index[2*count-2]) &&
+			mlz_in_stream_read_raw(stream, tail, 12) == 12 && !mlz_load_little_endian(tail) &&
+			(mlz_load_little_endian(tail+4) == MLZ_INDEX_MAGIC || mlz_load_little_endian(tail+8) == MLZ_INDEX_MAGIC);
+		if (!res) {
+			mlz_dealloc(stream->params.allocator, stream->index);
+			stream->index      = MLZ_NULL;
+			stream->index_size = 0;
+		}
+	}
+
+	return res;
+}
+
+mlz_bool
+mlz_in_stream_seek(
+	mlz_in_stream *stream,
+	mlz_ulong      offset
+)
+{
+	mlz_int entry = 0;
+
+	MLZ_RET_FALSE(stream);
+
+	if ((stream->mem || stream->params.seek_func) && !stream->index_loaded)
+		(void)mlz_in_stream_load_index(stream);
+
+	if (stream->index) {
+		/* last entry marks end of stream; find last seek point <= offset */
+		mlz_int lo = 0, hi = stream->index_size-2;
+
+		MLZ_RET_FALSE(offset <= stream->index[2*(stream->index_size-1)+1]);
+
+		while (lo < hi) {
+			mlz_int mid = (lo + hi + 1)/2;
+			if (stream->index[2*mid+1] <= offset)
+				lo = mid;
+			else
+				hi = mid-1;
+		}
+		entry = lo;
+	}
+
+	if (entry > 0) {
+		/* relative to end of input, so stream can start at any offset */
+		MLZ_RET_FALSE(mlz_in_stream_seek_raw(stream,
+			(mlz_long)stream->index[2*entry] - (mlz_long)stream->index_end));
+
+		stream->ptr             = MLZ_NULL;
+		stream->top             = MLZ_NULL;
+		stream->current_block   = 0;
+		stream->num_blocks      = 0;
+		stream->is_eof          = MLZ_FALSE;
+		stream->first_block     = MLZ_TRUE;
+		stream->first_cached    = MLZ_FALSE;
+		stream->next_block_size = 0;
+		stream->sync_cached     = MLZ_FALSE;
+		stream->seeked          = MLZ_TRUE;
+
+		offset -= stream->index[2*entry+1];
+	} else {
+		MLZ_RET_FALSE(mlz_in_stream_rewind(stream));
+	}
+
+	/* skip the rest */
+	while (offset > 0) {
+		mlz_intptr to_skip = offset > (mlz_ulong)MLZ_MAX_BLOCK_SIZE ? MLZ_MAX_BLOCK_SIZE : (mlz_intptr)offset;
+		MLZ_RET_FALSE(mlz_stream_read(stream, MLZ_NULL, to_skip) == to_skip);
+		offset -= (mlz_ulong)to_skip;
+	}
+
+	return MLZ_TRUE;
 }
 
 mlz_bool
@@ -552,15 +2717,33 @@ mlz_in_stream_close(
 {
 	MLZ_RET_FALSE(stream);
 
+#if defined(MLZ_THREADS)
+	/* reader may still be using handle */
+	MLZ_RET_FALSE(mlz_in_stream_stop_reader(stream));
+#endif
+
 	if (stream->params.close_func)
 		MLZ_RET_FALSE(stream->params.close_func(stream->params.handle));
 
 #if defined(MLZ_THREADS)
+	MLZ_RET_FALSE(mlz_batch_destroy(&stream->job_batch));
 	MLZ_RET_FALSE(mlz_mutex_destroy(stream->mutex));
 #endif
 
-	mlz_free(stream->buffer_unaligned);
-	mlz_free(stream);
+	if (stream->group_blocks)
+		mlz_dealloc(stream->params.allocator, stream->group_blocks);
+
+	if (stream->index)
+		mlz_dealloc(stream->params.allocator, stream->index);
+
+	mlz_dealloc(stream->params.allocator, stream->thread_data);
+
+	if (stream->read_buffer)
+		mlz_dealloc(stream->params.allocator, stream->read_buffer);
+
+	if (stream->buffer_unaligned)
+		mlz_dealloc(stream->params.allocator, stream->buffer_unaligned);
+	mlz_dealloc(stream->params.allocator, stream);
 	return MLZ_TRUE;
 }
 
@@ -571,3 +2754,11 @@ mlz_in_stream_eof(
 {
 	return stream && stream->is_eof;
 }
+
+mlz_long
+mlz_in_stream_content_size(
+	mlz_in_stream *stream
+)
+{
+	return stream ? stream->params.content_size : -1;
+}
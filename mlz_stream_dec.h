@@ -37,12 +37,41 @@
 extern "C" {
 #endif
 
+/* parsed stream (frame) header */
+typedef struct
+{
+	MLZ_CONST mlz_checksum_info *block_checksum;
+	MLZ_CONST mlz_checksum_info *incremental_checksum;
+	mlz_long             content_size;
+	mlz_int              block_size;
+	/* header size in bytes */
+	mlz_int              size;
+	/* bit 5: independent, bit 6: block chsum, bit 7: incremental chsum */
+	mlz_byte             flags;
+} mlz_in_header;
+
+/* block of a sync group */
+typedef struct
+{
+	/* compressed data (or uncompressed data in place) */
+	MLZ_CONST mlz_byte  *target;
+	mlz_int              blk_size;
+	mlz_int              usize;
+	/* uncompressed offset within group */
+	mlz_int              offset;
+	mlz_bool             uncompressed;
+	/* compressed block checksum, verified by group job */
+	mlz_ulong            checksum;
+} mlz_in_group_block;
+
 typedef struct
 {
 	/* 64k previous context, nk block size, nkb unpack reserve */
 	mlz_byte            *buffer;
 	/* original unaligned buffer ptr */
 	mlz_byte            *buffer_unaligned;
+	/* allocated buffer size (without alignment) */
+	size_t               buffer_size;
 	MLZ_CONST mlz_byte  *ptr;
 	MLZ_CONST mlz_byte  *top;
 	mlz_stream_params    params;
@@ -50,6 +79,19 @@ typedef struct
 	mlz_int              block_size;
 	mlz_int              block_reserve;
 	mlz_int              context_size;
+	/* stream header size in bytes (0 = no header) */
+	mlz_int              header_size;
+	/* uncompressed bytes decoded so far (to validate content size) */
+	mlz_ulong            uoffset;
+	/* read-ahead buffer (MLZ_NULL if off) */
+	mlz_byte            *read_buffer;
+	/* read-ahead buffer size (async_read: at least one batch of blocks) */
+	mlz_intptr           read_size;
+	/* memory input (see mlz_in_stream_open_memory), MLZ_NULL if off */
+	MLZ_CONST mlz_byte  *mem;
+	/* read position and size of read-ahead buffer or memory input */
+	mlz_intptr           read_pos;
+	mlz_intptr           read_top;
 	/* precaching because of incremental checksum */
 	mlz_uint             next_block_size;
 
@@ -57,20 +99,70 @@ typedef struct
 	mlz_int              num_threads;
 	mlz_int              current_block;
 	mlz_int              num_blocks;
-	/* helpers for multi-threaded block decompression */
-	mlz_byte            *block_targets[MLZ_MAX_THREADS];
-	mlz_int              blk_sizes    [MLZ_MAX_THREADS];
-	mlz_bool             unc_blocks   [MLZ_MAX_THREADS];
-	mlz_int              usizes       [MLZ_MAX_THREADS];
-	size_t               dlens        [MLZ_MAX_THREADS];
+	/* helpers for multi-threaded block decompression, max_threads */
+	/* entries each, all allocated as thread_data                  */
+	MLZ_CONST mlz_byte **block_targets;
+	mlz_int             *blk_sizes;
+	mlz_bool            *unc_blocks;
+	mlz_int             *usizes;
+	size_t              *dlens;
+	/* compressed block checksums, verified by decompression jobs */
+	mlz_ulong           *blk_checksums;
+	/* incremental checksums of blocks (groups) if combine_checksum is used */
+	mlz_uint            *checksums;
+	void                *thread_data;
+	mlz_int              max_threads;
+	/* distance between thread slots in buffer */
+	mlz_int              slot_size;
+
+	/* sync groups: multi-threaded decompression of dependent blocks */
+	/* each thread slot holds a group of up to sync_interval blocks  */
+	/* followed by staging area for compressed data                  */
+	mlz_in_group_block  *group_blocks;
+	mlz_int             *group_counts;
+	mlz_int              sync_interval;
+	mlz_bool             group_mode;
+	/* sync interval of precached block already read */
+	mlz_bool             sync_cached;
+	/* current block is a sync block (dependent blocks only) */
+	mlz_bool             block_sync;
+
+	/* block index: compressed, uncompressed offset pairs of seek points */
+	/* loaded on first seek; offsets are relative to start of stream,    */
+	/* index_end is the stream size up to the end of trailer, which must  */
+	/* coincide with end of input (stream may start anywhere in handle)   */
+	mlz_ulong           *index;
+	mlz_int              index_size;
+	mlz_ulong            index_end;
+	mlz_bool             index_loaded;
+	/* positioned using seek: incremental checksum can't be verified */
+	mlz_bool             seeked;
 
 	mlz_bool             is_eof;
 	mlz_bool             first_block;
 	/* first block cached? allows fast rewind early */
 	mlz_bool             first_cached;
 
+	/* concatenated streams (multi_frame): index of current frame */
+	/* and header of next frame found at end of current one       */
+	mlz_int              frame;
+	mlz_in_header        next_header;
+	mlz_bool             frame_pending;
+
 #if defined(MLZ_THREADS)
 	mlz_mutex            mutex;
+	/* completion of blocks queued to params.jobs (pool can be shared) */
+	mlz_batch            job_batch;
+	/* background reader (async_read): fills read_back (next batch of   */
+	/* compressed blocks) while read_buffer is being consumed;          */
+	/* read_back_size is result of read_func                            */
+	mlz_thread           reader;
+	mlz_event            read_start_event;
+	mlz_event            read_done_event;
+	mlz_byte            *read_back;
+	mlz_intptr           read_back_size;
+	mlz_bool             read_pending;
+	mlz_bool             read_stop;
 #endif
 
 } mlz_in_stream;
@@ -90,12 +182,129 @@ mlz_adler32_simple(
 	size_t size
 );
 
+/* combine adler32 of two adjacent chunks, next must start from 1 */
+MLZ_API mlz_uint
+mlz_adler32_combine(
+	mlz_uint prev,
+	mlz_uint next,
+	size_t next_size
+);
+
+/* CRC32C (Castagnoli), uses SSE4.2 if available */
+MLZ_API mlz_uint
+mlz_crc32c(
+	MLZ_CONST void *buf,
+	size_t size,
+	mlz_uint checksum
+);
+
+/* simple block variant of the above */
+MLZ_API mlz_uint
+mlz_crc32c_simple(
+	MLZ_CONST void *buf,
+	size_t size
+);
+
+/* combine CRC32C of two adjacent chunks, next must start from 0 */
+MLZ_API mlz_uint
+mlz_crc32c_combine(
+	mlz_uint prev,
+	mlz_uint next,
+	size_t next_size
+);
+
+/* 64-bit xxhash */
+MLZ_API mlz_ulong
+mlz_xxh64(
+	MLZ_CONST void *buf,
+	size_t size,
+	mlz_ulong seed
+);
+
+/* 64-bit xxhash with zero seed (block_checksum64) */
+MLZ_API mlz_ulong
+mlz_xxh64_simple(
+	MLZ_CONST void *buf,
+	size_t size
+);
+
+/* checksum functions for given type (MLZ_CHECKSUM_*), MLZ_NULL if unknown */
+MLZ_API MLZ_CONST mlz_checksum_info *
+mlz_get_checksum_info(
+	mlz_int type
+);
+
 /* returns new stream or MLZ_NULL on failure */
 MLZ_API mlz_in_stream *
 mlz_in_stream_open(
 	MLZ_CONST mlz_stream_params *params
 );
 
+/* open stream decoding from memory (e.g. memory-mapped file) without */
+/* copying compressed blocks; data must stay valid until stream is     */
+/* closed; read_func, rewind_func and seek_func are not used,          */
+/* close_func is still called with handle (e.g. to unmap data)         */
+/* returns new stream or MLZ_NULL on failure                           */
+MLZ_API mlz_in_stream *
+mlz_in_stream_open_memory(
+	MLZ_CONST mlz_stream_params *params,
+	MLZ_CONST void              *data,
+	size_t                       size
+);
+
+/* close current stream (calls close_func) and start decoding new one */
+/* with new params (handle, callbacks, ...), reusing buffers, mutex   */
+/* and background reader; no allocations unless buffer layout grows   */
+/* returns MLZ_TRUE on success, on failure stream is closed           */
+MLZ_API mlz_bool
+mlz_in_stream_reset(
+	mlz_in_stream               *stream,
+	MLZ_CONST mlz_stream_params *params
+);
+
+/* as mlz_in_stream_reset, switching to memory input */
+/* (see mlz_in_stream_open_memory)                   */
+MLZ_API mlz_bool
+mlz_in_stream_reset_memory(
+	mlz_in_stream               *stream,
+	MLZ_CONST mlz_stream_params *params,
+	MLZ_CONST void              *data,
+	size_t                       size
+);
+
+/* scan concatenated streams (frames) in memory without decoding  */
+/* returns number of frames or -1 on error; total uncompressed     */
+/* size is stored to usize (optional)                              */
+MLZ_API mlz_intptr
+mlz_scan_frames(
+	MLZ_CONST void *data,
+	size_t          size,
+	mlz_ulong      *usize
+);
+
+/* size of first frame in memory (including block index) or 0 on */
+/* error; its uncompressed size is added to usize                 */
+MLZ_API size_t
+mlz_scan_frame(
+	MLZ_CONST void *data,
+	size_t          size,
+	mlz_ulong      *usize
+);
+
+/* decode concatenated streams (frames) from memory to dst; frames */
+/* are decoded in parallel using params->jobs, single frame uses   */
+/* jobs as usual; only jobs, unsafe and allocator are taken from   */
+/* params                                                          */
+/* returns decompressed size or -1 on error                        */
+MLZ_API mlz_intptr
+mlz_decompress_frames(
+	MLZ_CONST mlz_stream_params *params,
+	MLZ_CONST void              *src,
+	size_t                       src_size,
+	void                        *dst,
+	size_t                       dst_size
+);
+
 /* returns -1 on error, otherwise number of bytes read */
 MLZ_API mlz_intptr
 mlz_stream_read(
@@ -104,12 +313,42 @@ mlz_stream_read(
 	mlz_intptr     size
 );
 
+/* zero-copy read: obtain pointer to decoded data and its size   */
+/* data stays valid until next read, peek or rewind             */
+/* size is 0 on EOF                                              */
+/* returns MLZ_TRUE on success                                   */
+MLZ_API mlz_bool
+mlz_in_stream_peek(
+	mlz_in_stream       *stream,
+	MLZ_CONST void     **ptr,
+	mlz_intptr          *size
+);
+
+/* zero-copy read: mark size bytes returned by mlz_in_stream_peek as read */
+/* returns MLZ_TRUE on success                                            */
+MLZ_API mlz_bool
+mlz_in_stream_consume(
+	mlz_in_stream *stream,
+	mlz_intptr     size
+);
+
 /* returns MLZ_TRUE on success */
 MLZ_API mlz_bool
 mlz_in_stream_rewind(
 	mlz_in_stream *stream
 );
 
+/* seek to uncompressed offset                                      */
+/* uses block index if present and seek_func is set, otherwise      */
+/* rewinds if necessary and skips (decompresses) up to offset       */
+/* note: incremental checksum isn't verified after seeking          */
+/* returns MLZ_TRUE on success                                      */
+MLZ_API mlz_bool
+mlz_in_stream_seek(
+	mlz_in_stream *stream,
+	mlz_ulong      offset
+);
+
 /* returns MLZ_TRUE on success */
 MLZ_API mlz_bool
 mlz_in_stream_close(
@@ -124,6 +363,13 @@ mlz_in_stream_eof(
 	mlz_in_stream *stream
 );
 
+/* returns uncompressed size stored in stream header or -1 if unknown */
+/* (of current frame if multi_frame is used)                          */
+MLZ_API mlz_long
+mlz_in_stream_content_size(
+	mlz_in_stream *stream
+);
+
 #ifdef __cplusplus
 }
 #endif
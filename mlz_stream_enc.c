@@ -29,52 +29,164 @@
 
 #include "mlz_stream_enc.h"
 #include "mlz_enc.h"
+/* mlz_adler32 */
+#include "mlz_stream_dec.h"
 #include <string.h>
 
+enum
+{
+	/* adaptive block size: larger blocks must improve ratio by 1/n */
+	MLZ_ADAPT_MIN_GAIN = 128,
+	/* full batches before larger block size is probed again */
+	MLZ_ADAPT_PROBE    = 16
+};
+
+/* log2 of power of two */
+static mlz_int mlz_log2(mlz_int value)
+{
+	mlz_int res = 0;
+
+	while (value > 1) {
+		value >>= 1;
+		res++;
+	}
+
+	return res;
+}
+
+/* stream buffer (all slots) must fit in mlz_int including alignment */
+#define MLZ_MAX_STREAM_BUFFER_SIZE (0x7fffffff - MLZ_CACHELINE_ALIGN)
+
 static mlz_bool mlz_out_stream_free(mlz_out_stream *stream)
 {
 	mlz_int i;
+
+#if defined(MLZ_THREADS)
+	/* make sure no job touches our buffers anymore */
+	if (stream->batch && stream->params.jobs)
+		MLZ_RET_FALSE(mlz_jobs_wait_ex(stream->params.jobs, &stream->job_batch));
+#endif
+
 	for (i=0; i<stream->num_threads; i++)
 		MLZ_RET_FALSE(mlz_matcher_free(stream->matchers[i]));
 
+	mlz_dealloc(stream->params.allocator, stream->thread_data);
+
 #if defined(MLZ_THREADS)
+	MLZ_RET_FALSE(mlz_batch_destroy(&stream->job_batch));
 	MLZ_RET_FALSE(mlz_mutex_destroy(stream->mutex));
 #endif
 
-	mlz_free(stream->buffer_unaligned);
-	mlz_free(stream);
+	if (stream->index)
+		mlz_dealloc(stream->params.allocator, stream->index);
+
+	mlz_dealloc(stream->params.allocator, stream->buffer_unaligned);
+	mlz_dealloc(stream->params.allocator, stream);
 
 	return MLZ_TRUE;
 }
 
-mlz_out_stream *
-mlz_out_stream_open(
-	MLZ_CONST mlz_stream_params *params,
-	mlz_int                      level
-)
+/* low level write, keeps track of compressed offset */
+static mlz_bool mlz_out_stream_write(mlz_out_stream *stream, MLZ_CONST void *buf, mlz_intptr size)
 {
-	mlz_byte       *buf;
-	mlz_out_stream *outs;
-	mlz_int         i, context_size;
-	mlz_int         num_threads = 1;
+	MLZ_RET_FALSE(stream->params.write_func(stream->params.handle, buf, size) == size);
+	stream->coffset += (mlz_ulong)size;
+	return MLZ_TRUE;
+}
+
+static void mlz_store_little_endian(mlz_byte *buf, mlz_uint val)
+{
+	buf[0] = (mlz_byte)(val & 255);
+	buf[1] = (mlz_byte)((val >> 8) & 255);
+	buf[2] = (mlz_byte)((val >> 16) & 255);
+	buf[3] = (mlz_byte)((val >> 24) & 255);
+}
+
+/* return type of known checksum function or -1 */
+static mlz_int mlz_block_checksum_type(MLZ_CONST mlz_stream_params *params)
+{
+	mlz_int i;
+
+	for (i=0; params->block_checksum64 && i<MLZ_CHECKSUM_COUNT; i++)
+		if (params->block_checksum64 == mlz_get_checksum_info(i)->block_checksum64)
+			return i;
+
+	for (i=0; !params->block_checksum64 && params->block_checksum && i<MLZ_CHECKSUM_COUNT; i++)
+		if (params->block_checksum == mlz_get_checksum_info(i)->block_checksum)
+			return i;
+
+	return -1;
+}
+
+static mlz_int mlz_incremental_checksum_type(mlz_uint (*func)(MLZ_CONST void *, size_t, mlz_uint))
+{
+	mlz_int i;
+
+	for (i=0; func && i<MLZ_CHECKSUM_COUNT; i++)
+		if (func == mlz_get_checksum_info(i)->incremental_checksum)
+			return i;
+
+	return -1;
+}
+
+/* grow per-thread arrays, keeping matchers */
+static mlz_bool mlz_out_stream_alloc_threads(mlz_out_stream *stream, mlz_int num_threads)
+{
+	mlz_byte *buf;
+	size_t    n = (size_t)num_threads;
+	mlz_int   i;
+
+	if (num_threads <= stream->max_threads)
+		return MLZ_TRUE;
+
+	buf = (mlz_byte *)mlz_alloc(stream->params.allocator,
+		n*(sizeof(struct mlz_matcher *) + 2*sizeof(size_t) + 2*sizeof(mlz_uint)));
+	MLZ_RET_FALSE(buf);
+
+	for (i=0; i<num_threads; i++)
+		((struct mlz_matcher **)buf)[i] = i < stream->num_threads ? stream->matchers[i] : MLZ_NULL;
+
+	mlz_dealloc(stream->params.allocator, stream->thread_data);
+	stream->thread_data = buf;
+	stream->max_threads = num_threads;
+
+	/* pointers and size_t first to keep alignment */
+	stream->matchers              = (struct mlz_matcher **)buf;
+	buf                          += n*sizeof(struct mlz_matcher *);
+	stream->batches[0].out_lens   = (size_t *)buf;
+	stream->batches[1].out_lens   = (size_t *)buf + n;
+	buf                          += 2*n*sizeof(size_t);
+	stream->batches[0].checksums  = (mlz_uint *)buf;
+	stream->batches[1].checksums  = (mlz_uint *)buf + n;
+	return MLZ_TRUE;
+}
+
+/* set up stream for new params: (re)allocates buffers and matchers only */
+/* if layout changed, resets stream state and writes header              */
+static mlz_bool mlz_out_stream_init(mlz_out_stream *stream, MLZ_CONST mlz_stream_params *params, mlz_int level)
+{
+	mlz_byte *buf;
+	mlz_int   i, context_size, slot_size;
+	mlz_int   num_threads = 1;
+	mlz_int   num_slots   = 1;
+	mlz_bool  pipelined   = MLZ_FALSE;
 
 	MLZ_RET_FALSE(params);
 	/* block size test */
 	MLZ_RET_FALSE(params->block_size >= MLZ_MIN_BLOCK_SIZE && params->block_size < MLZ_MAX_BLOCK_SIZE);
 	/* power of two test */
 	MLZ_RET_FALSE(!((mlz_uint)params->block_size & ((mlz_uint)params->block_size-1)));
+	/* sync interval test */
+	MLZ_RET_FALSE(params->sync_interval >= 0 &&
+		params->sync_interval <= MLZ_MAX_BLOCK_SIZE/params->block_size);
+	/* adaptive block size test */
+	MLZ_RET_FALSE(!params->min_block_size || (params->min_block_size >= MLZ_MIN_BLOCK_SIZE &&
+		params->min_block_size <= params->block_size &&
+		!((mlz_uint)params->min_block_size & ((mlz_uint)params->min_block_size-1))));
 	/* write function test */
 	MLZ_RET_FALSE(params->write_func);
-
-	outs = (mlz_out_stream *)mlz_malloc(sizeof(mlz_out_stream));
-	MLZ_RET_FALSE(outs);
-	memset(outs, 0, sizeof(mlz_out_stream));
-
-#if defined(MLZ_THREADS)
-	outs->mutex = mlz_mutex_create();
-	if (!outs->mutex)
-		goto out_stream_error;
-#endif
+	/* stream memory was allocated using this allocator */
+	MLZ_RET_FALSE(params->allocator == stream->params.allocator);
 
 	context_size = MLZ_BLOCK_CONTEXT_SIZE;
 	if (params->block_size < context_size)
@@ -86,39 +198,86 @@ mlz_out_stream_open(
 #if defined(MLZ_THREADS)
 	if (params->jobs)
 		num_threads += params->jobs->num_threads;
-	if (num_threads < 1 || num_threads > MLZ_MAX_THREADS)
-		goto out_stream_error;
+	if (params->jobs && params->pipelined) {
+		/* all blocks are compressed by workers while we fill the other slot */
+		pipelined = MLZ_TRUE;
+		num_threads--;
+		num_slots = 2;
+	}
+	MLZ_RET_FALSE(num_threads >= 1);
 #endif
 
-	outs->buffer_unaligned = (mlz_byte *)mlz_malloc(context_size + params->block_size*2*num_threads + MLZ_CACHELINE_ALIGN-1);
-	if (!outs->buffer_unaligned) {
-out_stream_error:
-		(void)mlz_out_stream_free(outs);
-		return MLZ_NULL;
+	/* many threads with large blocks may not fit, reject */
+	MLZ_RET_FALSE((size_t)num_threads <=
+		((size_t)MLZ_MAX_STREAM_BUFFER_SIZE/(size_t)num_slots - (size_t)context_size)/
+		(2*(size_t)params->block_size));
+
+	/* note: slot size is a multiple of 1k so slots stay aligned */
+	slot_size = (mlz_int)((size_t)context_size + 2*(size_t)params->block_size*(size_t)num_threads);
+
+	if (slot_size*num_slots != stream->buffer_size) {
+		if (stream->buffer_unaligned)
+			mlz_dealloc(stream->params.allocator, stream->buffer_unaligned);
+		stream->buffer_size      = 0;
+		stream->buffer_unaligned = (mlz_byte *)mlz_alloc(stream->params.allocator,
+			slot_size*num_slots + MLZ_CACHELINE_ALIGN-1);
+		MLZ_RET_FALSE(stream->buffer_unaligned);
+		stream->buffer_size      = slot_size*num_slots;
 	}
 
-	buf = outs->buffer_unaligned;
+	buf = stream->buffer_unaligned;
 	buf = (mlz_byte *)((mlz_uintptr)buf & ~((mlz_uintptr)MLZ_CACHELINE_ALIGN-1));
-	if (buf < outs->buffer_unaligned)
+	if (buf < stream->buffer_unaligned)
 		buf += MLZ_CACHELINE_ALIGN;
 
-	MLZ_ASSERT(buf >= outs->buffer_unaligned);
+	MLZ_ASSERT(buf >= stream->buffer_unaligned);
 
-	outs->buffer = buf;
+	stream->buffer = buf;
 
-	for (i=0; i<num_threads; i++)
-		if (!mlz_matcher_init(outs->matchers + i))
-			goto out_stream_error;
-
-	outs->block_size   = params->block_size;
-	outs->context_size = context_size;
-	outs->out_buffer   = buf + context_size + params->block_size*num_threads;
-	outs->checksum     = params->initial_checksum;
-	outs->ptr          = 0;
-	outs->level        = level < 1 ? 1 : (level > MLZ_LEVEL_OPTIMAL ? MLZ_LEVEL_OPTIMAL : level);
-	outs->num_threads  = num_threads;
-	outs->first_block  = MLZ_TRUE;
-	outs->params       = *params;
+	MLZ_RET_FALSE(mlz_out_stream_alloc_threads(stream, num_threads));
+
+	/* keep matchers we already have */
+	for (i=num_threads; i<stream->num_threads; i++) {
+		MLZ_RET_FALSE(mlz_matcher_free(stream->matchers[i]));
+		stream->matchers[i] = MLZ_NULL;
+	}
+	if (stream->num_threads > num_threads)
+		stream->num_threads = num_threads;
+	for (i=stream->num_threads; i<num_threads; i++) {
+		MLZ_RET_FALSE(mlz_matcher_init_ex(stream->matchers + i, params->allocator));
+		stream->num_threads = i+1;
+	}
+
+	stream->block_size    = params->min_block_size ? params->min_block_size : params->block_size;
+	stream->context_size  = context_size;
+	stream->out_buffer    = buf + context_size + (size_t)params->block_size*(size_t)num_threads;
+	stream->slot          = 0;
+	stream->slot_size     = slot_size;
+	stream->batch         = MLZ_NULL;
+	stream->checksum      = params->initial_checksum;
+	stream->ptr           = 0;
+	stream->level         = level < 1 ? 1 : (level > MLZ_LEVEL_OPTIMAL ? MLZ_LEVEL_OPTIMAL : level);
+	stream->num_threads   = num_threads;
+	stream->block_index   = 0;
+	stream->coffset       = 0;
+	stream->uoffset       = 0;
+	stream->index_size    = 0;
+	stream->history       = 0;
+	stream->adapt_batches = 0;
+	for (i=0; i<32; i++)
+		stream->adapt_ratios[i] = 0;
+	stream->pipelined     = pipelined;
+	stream->sync_interval = params->independent_blocks ? 0 : params->sync_interval;
+	stream->params        = *params;
+
+	/* known incremental checksum implies combine function, with or without */
+	/* header; custom checksum functions use combine_checksum as given      */
+	i = mlz_incremental_checksum_type(params->incremental_checksum);
+	if (i >= 0) {
+		MLZ_CONST mlz_checksum_info *info = mlz_get_checksum_info(i);
+		stream->params.combine_checksum = params->use_header ||
+			params->initial_checksum == info->initial_checksum ? info->combine_checksum : MLZ_NULL;
+	}
 
 	/* prepare simple 2-byte block header        */
 	/* bits 4-0: log2(block_size)                */
@@ -126,29 +285,106 @@ out_stream_error:
 	/* bit 6   : use block checksum (adler32)    */
 	/* bit 7   : use incremental chsum (adler32) */
 	/* 2nd byte = ~hdr (validation)              */
+	/* extended header (other checksum types or  */
+	/* content size known):                      */
+	/* bits 4-0 of 1st byte = 31, followed by    */
+	/* version, flags, log2(block_size),         */
+	/* checksum types (block | incremental << 4) */
+	/* [LE64 content size if flags & 1]          */
+	/* and LE32 adler32 of extension             */
 
 	if (params->use_header) {
-		mlz_byte hdr[2];
+		mlz_byte hdr[MLZ_MAX_HEADER_SIZE];
+		mlz_int  header_size = 2;
+		mlz_int  block_type = mlz_block_checksum_type(params);
+		mlz_int  incremental_type = mlz_incremental_checksum_type(params->incremental_checksum);
+		mlz_byte log_size = 0;
+
+		/* header can't describe custom 64-bit block checksum */
+		MLZ_RET_FALSE(!params->block_checksum64 || block_type >= 0);
+
 		hdr[0] = hdr[1] = 0;
 
 		i = 1;
 		while (params->block_size > i) {
-			hdr[0]++;
+			log_size++;
 			i <<= 1;
 		}
 
-		MLZ_ASSERT( hdr[0] < (1 << 5) );
+		MLZ_ASSERT( log_size < MLZ_HEADER_EXTENDED );
+
+		/* known incremental checksum: header implies initial value */
+		if (incremental_type >= 0) {
+			MLZ_CONST mlz_checksum_info *info = mlz_get_checksum_info(incremental_type);
+			stream->params.initial_checksum = info->initial_checksum;
+			stream->checksum                = info->initial_checksum;
+		}
+
+		hdr[0] = log_size;
+		if (block_type > MLZ_CHECKSUM_ADLER32 || incremental_type > MLZ_CHECKSUM_ADLER32 ||
+				params->content_size > 0) {
+			hdr[0] = MLZ_HEADER_EXTENDED;
+			hdr[2] = MLZ_HEADER_VERSION;
+			hdr[3] = 0;
+			hdr[4] = log_size;
+			hdr[5] = (mlz_byte)((block_type > 0 ? block_type : 0) |
+				((incremental_type > 0 ? incremental_type : 0) << 4));
+			header_size = 6;
+			if (params->content_size > 0) {
+				hdr[3] |= MLZ_HEADER_CONTENT_SIZE;
+				mlz_store_little_endian(hdr + 6, (mlz_uint)(params->content_size & 0xffffffffu));
+				mlz_store_little_endian(hdr + 10, (mlz_uint)((mlz_ulong)params->content_size >> 32));
+				header_size += 8;
+			}
+			mlz_store_little_endian(hdr + header_size, mlz_adler32(hdr + 2, header_size-2, 1));
+			header_size += 4;
+		}
 
 		if (params->independent_blocks)
 			hdr[0] |= 0x20;
-		if (params->block_checksum)
+		if (params->block_checksum || params->block_checksum64)
 			hdr[0] |= 0x40;
 		if (params->incremental_checksum)
 			hdr[0] |= 0x80;
 		hdr[1] = (mlz_byte)~hdr[0];
 
-		if (params->write_func(params->handle, hdr, 2) != 2)
-			goto out_stream_error;
+		MLZ_RET_FALSE(mlz_out_stream_write(stream, hdr, header_size));
+	}
+
+	return MLZ_TRUE;
+}
+
+mlz_out_stream *
+mlz_out_stream_open(
+	MLZ_CONST mlz_stream_params *params,
+	mlz_int                      level
+)
+{
+	mlz_out_stream *outs;
+
+	MLZ_RET_FALSE(params);
+
+	outs = (mlz_out_stream *)mlz_alloc(params->allocator, sizeof(mlz_out_stream));
+	MLZ_RET_FALSE(outs);
+	memset(outs, 0, sizeof(mlz_out_stream));
+	outs->params.allocator = params->allocator;
+
+#if defined(MLZ_THREADS)
+	outs->mutex = mlz_mutex_create();
+	if (!outs->mutex) {
+		mlz_dealloc(params->allocator, outs);
+		return MLZ_NULL;
+	}
+	if (!mlz_batch_init(&outs->job_batch)) {
+		(void)mlz_mutex_destroy(outs->mutex);
+		mlz_dealloc(params->allocator, outs);
+		return MLZ_NULL;
+	}
+#endif
+
+	if (!mlz_out_stream_init(outs, params, level)) {
+		(void)mlz_out_stream_free(outs);
+		return MLZ_NULL;
 	}
 
 	return outs;
@@ -157,102 +393,207 @@ out_stream_error:
 static mlz_bool mlz_write_little_endian(mlz_out_stream *stream, mlz_uint val)
 {
 	mlz_byte buf[4];
-	buf[0] = (mlz_byte)(val & 255);
-	buf[1] = (mlz_byte)((val >> 8) & 255);
-	buf[2] = (mlz_byte)((val >> 16) & 255);
-	buf[3] = (mlz_byte)((val >> 24) & 255);
-	return stream->params.write_func(stream->params.handle, buf, 4) == 4;
+	mlz_store_little_endian(buf, val);
+	return mlz_out_stream_write(stream, buf, 4);
+}
+
+static mlz_bool mlz_write_little_endian64(mlz_out_stream *stream, mlz_ulong val)
+{
+	return mlz_write_little_endian(stream, (mlz_uint)(val & 0xffffffffu)) &&
+		mlz_write_little_endian(stream, (mlz_uint)(val >> 32));
+}
+
+/* add seek point to block index */
+static mlz_bool mlz_out_stream_add_index(mlz_out_stream *stream)
+{
+	if (stream->index_size >= stream->index_capacity) {
+		mlz_int   capacity = stream->index_capacity ? 2*stream->index_capacity : 256;
+		mlz_ulong *index   = (mlz_ulong *)mlz_alloc(stream->params.allocator, sizeof(mlz_ulong)*2*capacity);
+		MLZ_RET_FALSE(index);
+		if (stream->index) {
+			memcpy(index, stream->index, sizeof(mlz_ulong)*2*stream->index_size);
+			mlz_dealloc(stream->params.allocator, stream->index);
+		}
+		stream->index          = index;
+		stream->index_capacity = capacity;
+	}
+
+	stream->index[2*stream->index_size]   = stream->coffset;
+	stream->index[2*stream->index_size+1] = stream->uoffset;
+	stream->index_size++;
+	return MLZ_TRUE;
+}
+
+/* block index trailer, follows end of stream:        */
+/* LE32 magic, LE32 count                             */
+/* count times: LE64 compressed, LE64 uncompressed ofs */
+/* (seek points + end of stream)                      */
+/* LE32 adler32 of entries, LE32 trailer size, magic  */
+static mlz_bool mlz_out_stream_write_index(mlz_out_stream *stream)
+{
+	mlz_int  i;
+	mlz_uint checksum = 1;
+
+	MLZ_RET_FALSE(mlz_write_little_endian(stream, MLZ_INDEX_MAGIC));
+	MLZ_RET_FALSE(mlz_write_little_endian(stream, (mlz_uint)stream->index_size));
+
+	for (i=0; i<2*stream->index_size; i++) {
+		mlz_byte buf[8];
+		mlz_int  j;
+		for (j=0; j<8; j++)
+			buf[j] = (mlz_byte)((stream->index[i] >> 8*j) & 255);
+		checksum = mlz_adler32(buf, 8, checksum);
+		MLZ_RET_FALSE(mlz_write_little_endian64(stream, stream->index[i]));
+	}
+
+	MLZ_RET_FALSE(mlz_write_little_endian(stream, checksum));
+	MLZ_RET_FALSE(mlz_write_little_endian(stream, (mlz_uint)(5*4 + 16*stream->index_size)));
+	return mlz_write_little_endian(stream, MLZ_INDEX_MAGIC);
+}
+
+/* first block and sync blocks don't use previous context */
+static mlz_bool mlz_out_stream_is_sync(mlz_out_stream *stream, mlz_ulong block_index)
+{
+	return !block_index || (stream->sync_interval > 0 && !(block_index % (mlz_ulong)stream->sync_interval));
+}
+
+/* compute incremental checksum per block in parallel? */
+static mlz_bool mlz_out_stream_par_checksum(mlz_out_stream *stream)
+{
+	return stream->params.incremental_checksum && stream->params.combine_checksum;
+}
+
+/* valid context bytes before i-th block of batch (i = number of blocks: after batch) */
+static mlz_int mlz_out_stream_history(mlz_out_stream *stream, mlz_out_batch *batch, mlz_int i)
+{
+	mlz_int j, res;
+	mlz_int ofs = i*batch->block_size;
+
+	if (ofs > batch->size)
+		ofs = batch->size;
+
+	res = batch->history + ofs;
+	for (j=0; j<i; j++)
+		if (mlz_out_stream_is_sync(stream, batch->block_index + j))
+			res = ofs - j*batch->block_size;
+
+	return res < stream->context_size ? res : stream->context_size;
 }
 
 static void mlz_compress_block_job(int thread, void *param)
 {
-	mlz_int ptr;
-	size_t  out_len;
+	mlz_int  ptr;
+	size_t   out_len;
+	mlz_uint checksum = 0;
 	mlz_out_stream *stream = (mlz_out_stream *)param;
-	mlz_int num_sub_blocks = (stream->ptr + stream->block_size-1)/stream->block_size;
+	mlz_out_batch  *batch  = stream->batch;
+	mlz_int num_sub_blocks = (batch->size + batch->block_size-1)/batch->block_size;
+	mlz_bool no_context    = mlz_out_stream_is_sync(stream, batch->block_index + thread);
+	mlz_int  context       = no_context ? 0 : mlz_out_stream_history(stream, batch, thread);
 
 	if (thread < num_sub_blocks-1)
-		ptr = stream->block_size;
+		ptr = batch->block_size;
 	else
-		ptr = stream->ptr - thread*stream->block_size;
+		ptr = batch->size - thread*batch->block_size;
 
 	/* flush (compress) */
 	out_len = mlz_compress(
 		stream->matchers[thread],
-		stream->out_buffer + thread*stream->block_size,
-		stream->block_size,
-		stream->buffer + stream->context_size + thread*stream->block_size,
+		batch->out_buffer + thread*batch->block_size,
+		batch->block_size,
+		batch->buffer + stream->context_size + thread*batch->block_size,
 		ptr,
-		stream->context_size,
+		context,
 		stream->level
 	);
+
+	if (mlz_out_stream_par_checksum(stream))
+		checksum = stream->params.incremental_checksum(
+			batch->buffer + stream->context_size + thread*batch->block_size,
+			ptr, stream->params.initial_checksum);
+
 #if defined(MLZ_THREADS)
 	(void)mlz_mutex_lock(stream->mutex);
-	stream->out_lens[thread] = out_len;
+	batch->out_lens[thread]  = out_len;
+	batch->checksums[thread] = checksum;
 	(void)mlz_mutex_unlock(stream->mutex);
 #else
-	stream->out_lens[thread] = out_len;
+	batch->out_lens[thread]  = out_len;
+	batch->checksums[thread] = checksum;
 #endif
 }
 
-static mlz_bool mlz_out_stream_flush_block(mlz_out_stream *stream)
+/* start compressing current slot as a new batch */
+static mlz_out_batch *mlz_out_stream_start_batch(mlz_out_stream *stream)
 {
-	size_t out_len;
-	mlz_int i, num_sub_blocks;
+	mlz_out_batch *batch = stream->batches + stream->slot;
+	mlz_int        num_blocks = (stream->ptr + stream->block_size-1)/stream->block_size;
 
-	MLZ_ASSERT(stream);
-	/* if nothing to do => success */
-	if (!stream->ptr)
-		return MLZ_TRUE;
+	batch->buffer      = stream->buffer;
+	batch->out_buffer  = stream->out_buffer;
+	batch->size        = stream->ptr;
+	batch->block_index = stream->block_index;
+	batch->history     = stream->history;
+	batch->block_size  = stream->block_size;
+	stream->batch      = batch;
 
-	num_sub_blocks = (stream->ptr + stream->block_size-1)/stream->block_size;
+	/* context available to next batch */
+	stream->history      = mlz_out_stream_history(stream, batch, num_blocks);
+	stream->block_index += num_blocks;
 
 #if defined(MLZ_THREADS)
 	if (stream->params.jobs) {
-		MLZ_RET_FALSE(mlz_jobs_prepare_batch(stream->params.jobs, num_sub_blocks-1));
-		for (i=1; i<num_sub_blocks; i++) {
+		/* in pipelined mode, workers do all the work */
+		mlz_int i, first = !stream->pipelined;
+
+		MLZ_RET_FALSE(mlz_jobs_prepare_batch_ex(stream->params.jobs, &stream->job_batch, num_blocks-first));
+		for (i=first; i<num_blocks; i++) {
 			mlz_job job;
 			job.job   = mlz_compress_block_job;
 			job.param = stream;
 			job.idx   = i;
-			MLZ_RET_FALSE(mlz_jobs_enqueue(stream->params.jobs, job));
+			MLZ_RET_FALSE(mlz_jobs_enqueue_ex(stream->params.jobs, &stream->job_batch, job));
 		}
 	}
 #endif
 
-	/* flush (compress) */
-	out_len = mlz_compress(
-		stream->matchers[0],
-		stream->out_buffer,
-		stream->block_size,
-		stream->buffer + stream->context_size,
-		num_sub_blocks > 1 ? stream->block_size : stream->ptr,
-		stream->context_size*(stream->first_block != MLZ_TRUE),
-		stream->level
-	);
+	return batch;
+}
 
+/* wait for batch being compressed */
+static mlz_bool mlz_out_stream_wait_batch(mlz_out_stream *stream)
+{
+	(void)stream;
 #if defined(MLZ_THREADS)
 	if (stream->params.jobs)
-		MLZ_RET_FALSE(mlz_jobs_wait(stream->params.jobs));
+		MLZ_RET_FALSE(mlz_jobs_wait_ex(stream->params.jobs, &stream->job_batch));
 #endif
+	return MLZ_TRUE;
+}
 
-	stream->out_lens[0] = out_len;
+static mlz_bool mlz_out_stream_write_batch(mlz_out_stream *stream, mlz_out_batch *batch)
+{
+	size_t out_len;
+	mlz_int i, num_sub_blocks;
+	/* compressed size of batch */
+	mlz_ulong csize = 0;
 
-	stream->first_block = MLZ_FALSE;
+	num_sub_blocks = (batch->size + batch->block_size-1)/batch->block_size;
 
 	for (i=0; i<num_sub_blocks; i++) {
 		size_t real_out_len;
 		mlz_int ptr;
 		mlz_bool partial_block     = MLZ_FALSE;
-		mlz_byte *out_ptr          = stream->out_buffer + i*stream->block_size;
-		MLZ_CONST mlz_byte *in_ptr = stream->buffer + stream->context_size + i*stream->block_size;
+		mlz_bool sync_block        = MLZ_FALSE;
+		mlz_byte *out_ptr          = batch->out_buffer + i*batch->block_size;
+		MLZ_CONST mlz_byte *in_ptr = batch->buffer + stream->context_size + i*batch->block_size;
 
 		if (i < num_sub_blocks-1)
-			ptr = stream->block_size;
+			ptr = batch->block_size;
 		else
-			ptr = stream->ptr - i*stream->block_size;
+			ptr = batch->size - i*batch->block_size;
 
-		out_len = stream->out_lens[i];
+		out_len = batch->out_lens[i];
 		real_out_len = out_len;
 
 		MLZ_ASSERT(out_len <= (size_t)MLZ_MAX_BLOCK_SIZE && ptr <= MLZ_MAX_BLOCK_SIZE);
@@ -265,11 +606,22 @@ static mlz_bool mlz_out_stream_flush_block(mlz_out_stream *stream)
 		}
 
 		/* mark as partial block if necessary */
-		if (ptr != stream->block_size) {
+		if (ptr != stream->params.block_size) {
 			real_out_len |= MLZ_PARTIAL_BLOCK_MASK;
 			partial_block = MLZ_TRUE;
 		}
 
+		/* mark sync block (only if syncing is enabled) */
+		if (stream->sync_interval > 0 && mlz_out_stream_is_sync(stream, batch->block_index + i)) {
+			real_out_len |= MLZ_SYNC_BLOCK_MASK;
+			sync_block = MLZ_TRUE;
+		}
+
+		/* record seek point */
+		if (stream->params.use_index &&
+				(stream->params.independent_blocks || mlz_out_stream_is_sync(stream, batch->block_index + i)))
+			MLZ_RET_FALSE(mlz_out_stream_add_index(stream));
+
 		/* execute block callback if desired */
 		if (stream->params.block_func)
 			stream->params.block_func(stream->params.handle);
@@ -277,10 +629,17 @@ static mlz_bool mlz_out_stream_flush_block(mlz_out_stream *stream)
 		/* write block len + flags */
 		MLZ_RET_FALSE(mlz_write_little_endian(stream, (mlz_uint)real_out_len));
 
+		if (sync_block)
+			MLZ_RET_FALSE(mlz_write_little_endian(stream, (mlz_uint)stream->sync_interval));
+
 		real_out_len &= MLZ_BLOCK_LEN_MASK;
+		csize        += (mlz_ulong)real_out_len;
 
 		/* compute and write compressed block checksum if needed */
-		if (stream->params.block_checksum) {
+		if (stream->params.block_checksum64) {
+			MLZ_RET_FALSE(mlz_write_little_endian64(stream,
+				stream->params.block_checksum64(out_ptr, real_out_len)));
+		} else if (stream->params.block_checksum) {
 			mlz_uint checksum = stream->params.block_checksum(out_ptr, real_out_len);
 			MLZ_RET_FALSE(mlz_write_little_endian(stream, (mlz_uint)checksum));
 		}
@@ -289,20 +648,140 @@ static mlz_bool mlz_out_stream_flush_block(mlz_out_stream *stream)
 			MLZ_RET_FALSE(mlz_write_little_endian(stream, (mlz_uint)ptr));
 
 		/* write block */
-		MLZ_RET_FALSE(stream->params.write_func(stream->params.handle, out_ptr,
-			(mlz_intptr)real_out_len) == (mlz_intptr)real_out_len);
+		MLZ_RET_FALSE(mlz_out_stream_write(stream, out_ptr, (mlz_intptr)real_out_len));
+		stream->uoffset += (mlz_ulong)ptr;
 
 		/* update incremental checksum if needed */
-		if (stream->params.incremental_checksum) {
+		if (mlz_out_stream_par_checksum(stream)) {
+			stream->checksum =
+				stream->params.combine_checksum(stream->checksum,
+					batch->checksums[i], (size_t)ptr);
+		} else if (stream->params.incremental_checksum) {
 			stream->checksum =
 				stream->params.incremental_checksum(in_ptr,
 					ptr, stream->checksum);
 		}
 	}
 
-	/* copy block context unless last block */
-	if (stream->context_size > 0 && stream->ptr >= stream->context_size)
-		memcpy(stream->buffer, stream->buffer + stream->ptr, stream->context_size);
+	/* adaptive block size: ratio of full batches at this block size */
+	if (stream->params.min_block_size && batch->size == batch->block_size*stream->num_threads)
+		stream->adapt_ratios[mlz_log2(batch->block_size)] =
+			(mlz_int)(csize*4096/(mlz_ulong)batch->size) + 1;
+
+	return MLZ_TRUE;
+}
+
+/* pipelined mode: wait for batch in flight and write it */
+static mlz_bool mlz_out_stream_drain(mlz_out_stream *stream)
+{
+	mlz_out_batch *batch = stream->batch;
+
+	if (!batch)
+		return MLZ_TRUE;
+
+	MLZ_RET_FALSE(mlz_out_stream_wait_batch(stream));
+	stream->batch = MLZ_NULL;
+
+	return mlz_out_stream_write_batch(stream, batch);
+}
+
+/* adaptive block size, simple heuristic (nothing is timed or measured): */
+/* batch cut short by flush means input arrives slowly, so shrink blocks */
+/* to split such batch among all threads again; each full batch doubles  */
+/* block size up to params.block_size (less overhead, better ratio)      */
+static void mlz_out_stream_adapt(mlz_out_stream *stream)
+{
+	mlz_int  size = stream->params.min_block_size;
+	mlz_int  cur, *ratios = stream->adapt_ratios;
+
+	if (!size)
+		return;
+
+	/* flush cut batch short: smallest size that still splits it among all threads */
+	if (stream->ptr < stream->block_size*stream->num_threads) {
+		while (size*stream->num_threads < stream->ptr && size < stream->params.block_size)
+			size <<= 1;
+		stream->block_size = size;
+		return;
+	}
+
+	/* full batch: larger blocks only while they pay off in ratio, */
+	/* otherwise smaller blocks keep latency down                   */
+	cur = mlz_log2(stream->block_size);
+
+	/* measure current size first (pipelined batches lag one behind) */
+	if (!ratios[cur])
+		return;
+
+	/* forget larger size now and then, data may have changed */
+	if (++stream->adapt_batches >= MLZ_ADAPT_PROBE && cur < 31) {
+		stream->adapt_batches = 0;
+		ratios[cur+1]         = 0;
+	}
+
+	if (stream->block_size > stream->params.min_block_size && ratios[cur-1] &&
+			ratios[cur] > ratios[cur-1] - ratios[cur-1]/MLZ_ADAPT_MIN_GAIN) {
+		/* not better than half the size */
+		stream->block_size >>= 1;
+	} else if (stream->block_size < stream->params.block_size &&
+			(!ratios[cur+1] || ratios[cur+1] <= ratios[cur] - ratios[cur]/MLZ_ADAPT_MIN_GAIN)) {
+		/* probe larger size or keep growing while it pays off */
+		stream->block_size <<= 1;
+		stream->adapt_batches = 0;
+	}
+}
+
+static mlz_bool mlz_out_stream_flush_block(mlz_out_stream *stream)
+{
+	mlz_out_batch *batch, *prev;
+	mlz_byte      *buf;
+
+	MLZ_ASSERT(stream);
+	/* if nothing to do => success */
+	if (!stream->ptr)
+		return MLZ_TRUE;
+
+	if (!stream->pipelined) {
+		batch = mlz_out_stream_start_batch(stream);
+		MLZ_RET_FALSE(batch);
+
+		/* this thread helps too */
+		mlz_compress_block_job(0, stream);
+
+		MLZ_RET_FALSE(mlz_out_stream_wait_batch(stream));
+		stream->batch = MLZ_NULL;
+
+		MLZ_RET_FALSE(mlz_out_stream_write_batch(stream, batch));
+
+		/* copy block context, short (flushed) batch slides it */
+		if (stream->context_size > 0)
+			memmove(stream->buffer, stream->buffer + stream->ptr, stream->context_size);
+	} else {
+		/* wait for previous batch, start compressing this one */
+		/* and write previous batch in the meantime             */
+		prev = stream->batch;
+		if (prev)
+			MLZ_RET_FALSE(mlz_out_stream_wait_batch(stream));
+
+		batch = mlz_out_stream_start_batch(stream);
+		MLZ_RET_FALSE(batch);
+
+		if (prev)
+			MLZ_RET_FALSE(mlz_out_stream_write_batch(stream, prev));
+
+		/* switch to other slot, previous batch is done by now */
+		stream->slot ^= 1;
+		buf = stream->slot ? stream->buffer + stream->slot_size : stream->buffer - stream->slot_size;
+		stream->buffer     = buf;
+		stream->out_buffer = buf + stream->context_size +
+			(size_t)stream->params.block_size*(size_t)stream->num_threads;
+
+		/* copy block context, short (flushed) batch slides it */
+		if (stream->context_size > 0)
+			memcpy(stream->buffer, batch->buffer + stream->ptr, stream->context_size);
+	}
+
+	mlz_out_stream_adapt(stream);
 
 	/* reset pointer */
 	stream->ptr = 0;
@@ -311,12 +790,26 @@ static mlz_bool mlz_out_stream_flush_block(mlz_out_stream *stream)
 }
 
 mlz_bool
-mlz_out_stream_close(
+mlz_out_stream_flush(
 	mlz_out_stream *stream
 )
 {
 	MLZ_RET_FALSE(stream);
-	MLZ_RET_FALSE(mlz_out_stream_flush_block(stream));
+	return mlz_out_stream_flush_block(stream) && mlz_out_stream_drain(stream);
+}
+
+/* write end of stream and close handle, keeps buffers */
+static mlz_bool mlz_out_stream_finish(mlz_out_stream *stream)
+{
+	MLZ_RET_FALSE(mlz_out_stream_flush_block(stream) && mlz_out_stream_drain(stream));
+
+	/* content size announced in header must match */
+	MLZ_RET_FALSE(stream->params.content_size <= 0 ||
+		stream->uoffset == (mlz_ulong)stream->params.content_size);
+
+	/* end of stream is the last index entry */
+	if (stream->params.use_index)
+		MLZ_RET_FALSE(mlz_out_stream_add_index(stream));
 
 	/* encode end of stream */
 	MLZ_RET_FALSE(mlz_write_little_endian(stream, 0u));
@@ -325,12 +818,42 @@ mlz_out_stream_close(
 	if (stream->params.incremental_checksum)
 		MLZ_RET_FALSE(mlz_write_little_endian(stream, stream->checksum));
 
+	if (stream->params.use_index)
+		MLZ_RET_FALSE(mlz_out_stream_write_index(stream));
+
 	if (stream->params.close_func)
 		MLZ_RET_FALSE(stream->params.close_func(stream->params.handle));
 
+	return MLZ_TRUE;
+}
+
+mlz_bool
+mlz_out_stream_close(
+	mlz_out_stream *stream
+)
+{
+	MLZ_RET_FALSE(stream);
+	MLZ_RET_FALSE(mlz_out_stream_finish(stream));
 	return mlz_out_stream_free(stream);
 }
 
+mlz_bool
+mlz_out_stream_reset(
+	mlz_out_stream              *stream,
+	MLZ_CONST mlz_stream_params *params,
+	mlz_int                      level
+)
+{
+	MLZ_RET_FALSE(stream);
+
+	if (!mlz_out_stream_finish(stream) || !mlz_out_stream_init(stream, params, level)) {
+		(void)mlz_out_stream_free(stream);
+		return MLZ_FALSE;
+	}
+
+	return MLZ_TRUE;
+}
+
 mlz_intptr
 mlz_stream_write(
 	mlz_out_stream *stream,
@@ -361,3 +884,248 @@ mlz_stream_write(
 
 	return nwritten;
 }
+
+mlz_bool
+mlz_out_stream_acquire(
+	mlz_out_stream *stream,
+	void          **ptr,
+	mlz_intptr     *avail
+)
+{
+	mlz_int capacity;
+
+	MLZ_RET_FALSE(stream && ptr && avail);
+
+	capacity = stream->block_size*stream->num_threads;
+	if (stream->ptr >= capacity) {
+		MLZ_RET_FALSE(mlz_out_stream_flush_block(stream));
+		/* adaptive block size may have changed */
+		capacity = stream->block_size*stream->num_threads;
+	}
+
+	/* caller treats no room as end of stream */
+	MLZ_RET_FALSE(capacity > stream->ptr);
+
+	*ptr   = stream->buffer + stream->context_size + stream->ptr;
+	*avail = (mlz_intptr)(capacity - stream->ptr);
+	return MLZ_TRUE;
+}
+
+mlz_bool
+mlz_out_stream_commit(
+	mlz_out_stream *stream,
+	mlz_intptr      size
+)
+{
+	MLZ_RET_FALSE(stream && size >= 0 &&
+		size <= (mlz_intptr)stream->block_size*stream->num_threads - stream->ptr);
+
+	stream->ptr += (mlz_int)size;
+
+	if (stream->ptr >= stream->block_size*stream->num_threads)
+		MLZ_RET_FALSE(mlz_out_stream_flush_block(stream));
+
+	return MLZ_TRUE;
+}
+
+/* segments being compressed by mlz_compress_parallel */
+typedef struct
+{
+	MLZ_CONST mlz_byte      *src;
+	size_t                   src_size;
+	/* segment i is compressed to slot at slots + i*segment size */
+	mlz_byte                *slots;
+	size_t                   context_size;
+	int                      level;
+	MLZ_CONST mlz_allocator *allocator;
+	/* per segment: compressed size (0 = failed), adler32 */
+	mlz_uint                *sizes;
+	mlz_uint                *checksums;
+	size_t                   count;
+	/* next segment to take */
+	size_t                   next;
+#if defined(MLZ_THREADS)
+	/* guards next (MLZ_NULL = single thread) */
+	mlz_mutex                mutex;
+#endif
+} mlz_segment_batch;
+
+static void mlz_compress_segment(mlz_segment_batch *batch, struct mlz_matcher *matcher, size_t idx)
+{
+	size_t    offset  = idx*MLZ_SEGMENT_SIZE;
+	size_t    size    = batch->src_size - offset;
+	size_t    context = offset < batch->context_size ? offset : batch->context_size;
+	mlz_byte *dst     = batch->slots + offset;
+	size_t    csize;
+
+	if (size > MLZ_SEGMENT_SIZE)
+		size = MLZ_SEGMENT_SIZE;
+
+	batch->checksums[idx] = mlz_adler32(batch->src + offset, size, 1);
+
+	/* store segment if it doesn't fit in its slot */
+	csize = mlz_compress(matcher, dst, size, batch->src + offset, size, context, batch->level);
+
+	if (!csize || csize >= size) {
+		memcpy(dst, batch->src + offset, size);
+		csize = size | MLZ_UNCOMPRESSED_BLOCK_MASK;
+	}
+
+	batch->sizes[idx] = (mlz_uint)csize;
+}
+
+static size_t mlz_next_segment(mlz_segment_batch *batch)
+{
+	size_t res;
+
+#if defined(MLZ_THREADS)
+	if (batch->mutex)
+		(void)mlz_mutex_lock(batch->mutex);
+	res = batch->next++;
+	if (batch->mutex)
+		(void)mlz_mutex_unlock(batch->mutex);
+#else
+	res = batch->next++;
+#endif
+
+	return res;
+}
+
+/* one job per worker: takes segments until none are left, */
+/* reusing its matcher (segments left over keep size 0)     */
+static void mlz_compress_segments_job(int idx, void *param)
+{
+	mlz_segment_batch  *batch = (mlz_segment_batch *)param;
+	struct mlz_matcher *matcher;
+	size_t              i;
+
+	(void)idx;
+
+	if (!mlz_matcher_init_ex(&matcher, batch->allocator))
+		return;
+
+	while ((i = mlz_next_segment(batch)) < batch->count)
+		mlz_compress_segment(batch, matcher, i);
+
+	(void)mlz_matcher_free(matcher);
+}
+
+size_t
+mlz_compress_parallel_bound(
+	size_t src_size
+)
+{
+	return MLZ_SEGMENTED_HEADER_SIZE + 4*((src_size + MLZ_SEGMENT_SIZE-1)/MLZ_SEGMENT_SIZE) + src_size;
+}
+
+size_t
+mlz_compress_parallel(
+	void            *dst,
+	size_t           dst_size,
+	MLZ_CONST void  *src,
+	size_t           src_size,
+	int              level,
+	struct mlz_jobs *jobs
+)
+{
+	return mlz_compress_parallel_ex(dst, dst_size, src, src_size, level, jobs, 0, MLZ_NULL);
+}
+
+size_t
+mlz_compress_parallel_ex(
+	void                    *dst,
+	size_t                   dst_size,
+	MLZ_CONST void          *src,
+	size_t                   src_size,
+	int                      level,
+	struct mlz_jobs         *jobs,
+	size_t                   context_size,
+	MLZ_CONST mlz_allocator *allocator
+)
+{
+	mlz_segment_batch batch;
+	mlz_byte         *db = (mlz_byte *)dst;
+	size_t            i, count, pos;
+	mlz_uint          checksum = 1;
+	mlz_bool          res      = MLZ_TRUE;
+
+	MLZ_RET_FALSE(dst && (src || !src_size) && (mlz_ulong)src_size <= 0xffffffffu);
+	MLZ_RET_FALSE(dst_size >= mlz_compress_parallel_bound(src_size));
+	MLZ_RET_FALSE(context_size <= MLZ_BLOCK_CONTEXT_SIZE);
+
+	count = (src_size + MLZ_SEGMENT_SIZE-1)/MLZ_SEGMENT_SIZE;
+	pos   = MLZ_SEGMENTED_HEADER_SIZE + 4*count;
+
+	batch.src          = (MLZ_CONST mlz_byte *)src;
+	batch.src_size     = src_size;
+	batch.slots        = db + pos;
+	batch.context_size = context_size;
+	batch.level        = level;
+	batch.allocator    = allocator;
+	batch.count        = count;
+	batch.next         = 0;
+	batch.sizes        = (mlz_uint *)mlz_alloc(allocator, 2*sizeof(mlz_uint)*(count ? count : 1));
+	MLZ_RET_FALSE(batch.sizes);
+	batch.checksums    = batch.sizes + count;
+
+	for (i=0; i<count; i++)
+		batch.sizes[i] = 0;
+
+#if defined(MLZ_THREADS)
+	batch.mutex = MLZ_NULL;
+
+	/* one job per worker, this thread takes part too */
+	if (jobs && count > 1) {
+		mlz_batch jobs_batch;
+		size_t    num_jobs = (size_t)jobs->num_threads < count-1 ? (size_t)jobs->num_threads : count-1;
+
+		batch.mutex = mlz_mutex_create();
+		res = batch.mutex && mlz_batch_init(&jobs_batch);
+		if (res) {
+			res = mlz_jobs_prepare_batch_ex(jobs, &jobs_batch, (mlz_int)num_jobs);
+			for (i=0; res && i<num_jobs; i++) {
+				mlz_job job;
+				job.job   = mlz_compress_segments_job;
+				job.param = &batch;
+				job.idx   = (int)i+1;
+				res = mlz_jobs_enqueue_ex(jobs, &jobs_batch, job);
+			}
+			if (res)
+				mlz_compress_segments_job(0, &batch);
+			res = mlz_jobs_wait_ex(jobs, &jobs_batch) && res;
+			res = mlz_batch_destroy(&jobs_batch) && res;
+		}
+		if (batch.mutex)
+			res = mlz_mutex_destroy(batch.mutex) && res;
+	} else
+#else
+	(void)jobs;
+#endif
+	mlz_compress_segments_job(0, &batch);
+
+	/* pack segments behind segment table */
+	for (i=0; res && i<count; i++) {
+		size_t size = batch.sizes[i] & ~(mlz_uint)MLZ_UNCOMPRESSED_BLOCK_MASK;
+		size_t usize = src_size - i*MLZ_SEGMENT_SIZE;
+
+		if (usize > MLZ_SEGMENT_SIZE)
+			usize = MLZ_SEGMENT_SIZE;
+
+		res = size != 0;
+		memmove(db + pos, batch.slots + i*MLZ_SEGMENT_SIZE, size);
+		mlz_store_little_endian(db + MLZ_SEGMENTED_HEADER_SIZE + 4*i, batch.sizes[i]);
+		checksum = mlz_adler32_combine(checksum, batch.checksums[i], usize);
+		pos += size;
+	}
+
+	mlz_dealloc(allocator, batch.sizes);
+	MLZ_RET_FALSE(res);
+
+	mlz_store_little_endian(db,      MLZ_SEGMENTED_MAGIC);
+	mlz_store_little_endian(db + 4,  (mlz_uint)src_size);
+	mlz_store_little_endian(db + 8,  checksum);
+	mlz_store_little_endian(db + 12, MLZ_SEGMENT_SIZE);
+	mlz_store_little_endian(db + 16, (mlz_uint)context_size);
+
+	return pos;
+}
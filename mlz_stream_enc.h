@@ -39,29 +39,85 @@ extern "C" {
 
 struct mlz_matcher;
 
+/* batch of up to num_threads blocks compressed in parallel */
+typedef struct
+{
+	/* 64k previous context, nk block size; points into stream buffer */
+	mlz_byte            *buffer;
+	/* nk output buffer; points into stream buffer */
+	mlz_byte            *out_buffer;
+	/* temporary output lengths in multi-threaded mode */
+	size_t              *out_lens;
+	/* incremental checksums of blocks if combine_checksum is used */
+	mlz_uint            *checksums;
+	/* uncompressed size */
+	mlz_int              size;
+	/* index of first block in batch */
+	mlz_ulong            block_index;
+	/* valid context bytes before first block */
+	mlz_int              history;
+	/* block size used to split this batch */
+	mlz_int              block_size;
+} mlz_out_batch;
+
 typedef struct
 {
 	/* for each parallel thread */
-	struct mlz_matcher  *matchers[MLZ_MAX_THREADS];
+	struct mlz_matcher **matchers;
+	/* per-thread arrays (matchers, batch lengths and checksums) */
+	/* allocated as thread_data for up to max_threads            */
+	void                *thread_data;
+	mlz_int              max_threads;
 	/* original unaligned buffer ptr */
 	mlz_byte            *buffer_unaligned;
+	/* allocated buffer size (without alignment), all slots */
+	mlz_int              buffer_size;
 	/* 64k previous context, nk block size, nk output buffer; 1k aligned */
+	/* pipelined mode uses two such slots                                */
 	mlz_byte            *buffer;
 	/* points into buffer */
 	mlz_byte            *out_buffer;
 	mlz_stream_params    params;
-	/* temporary output lengths in multi-threaded mode */
-	size_t               out_lens[MLZ_MAX_THREADS];
+	/* batch descriptors, one per slot */
+	mlz_out_batch        batches[2];
+	/* batch being compressed or MLZ_NULL */
+	mlz_out_batch       *batch;
 	mlz_uint             checksum;
 	mlz_int              ptr;
+	/* current block size; adaptive mode varies it between */
+	/* params.min_block_size and params.block_size         */
 	mlz_int              block_size;
+	/* adaptive mode: compressed/uncompressed ratio (1/4096 units, 0 = not */
+	/* measured) of last full batch per log2(block size) and full batches  */
+	/* since larger block size was last probed                             */
+	mlz_int              adapt_ratios[32];
+	mlz_int              adapt_batches;
 	mlz_int              context_size;
 	mlz_int              level;
 	mlz_int              num_threads;
-	mlz_bool             first_block;
+	/* buffer slot being filled */
+	mlz_int              slot;
+	mlz_int              slot_size;
+	/* number of blocks compressed so far */
+	mlz_ulong            block_index;
+	/* compressed and uncompressed bytes written so far */
+	mlz_ulong            coffset;
+	mlz_ulong            uoffset;
+	/* block index: compressed, uncompressed offset pairs of seek points */
+	mlz_ulong           *index;
+	mlz_int              index_size;
+	mlz_int              index_capacity;
+	mlz_int              sync_interval;
+	/* valid context bytes (since last sync point, up to context_size) */
+	/* less than context_size after flushing short partial block       */
+	mlz_int              history;
+	/* compress in background while filling next batch */
+	mlz_bool             pipelined;
 
 #if defined(MLZ_THREADS)
 	mlz_mutex            mutex;
+	/* completion of blocks queued to params.jobs (pool can be shared) */
+	mlz_batch            job_batch;
 #endif
 
 } mlz_out_stream;
@@ -82,12 +138,53 @@ mlz_stream_write(
 	mlz_intptr      size
 );
 
+/* zero-copy write: obtain pointer to internal staging buffer          */
+/* and number of bytes that can be written there (always at least one) */
+/* returns MLZ_TRUE on success                                         */
+MLZ_API mlz_bool
+mlz_out_stream_acquire(
+	mlz_out_stream *stream,
+	void          **ptr,
+	mlz_intptr     *avail
+);
+
+/* zero-copy write: commit size bytes written to acquired buffer */
+/* size must not exceed avail returned by mlz_out_stream_acquire */
+/* returns MLZ_TRUE on success                                   */
+MLZ_API mlz_bool
+mlz_out_stream_commit(
+	mlz_out_stream *stream,
+	mlz_intptr      size
+);
+
+/* compress and write buffered data now (as partial block if needed), */
+/* keeping context for dependent blocks; bounds latency of streaming  */
+/* without closing the stream, but frequent flushes hurt ratio        */
+/* note: handle itself isn't flushed                                  */
+/* returns MLZ_TRUE on success                                        */
+MLZ_API mlz_bool
+mlz_out_stream_flush(
+	mlz_out_stream *stream
+);
+
 /* returns MLZ_TRUE on success */
 MLZ_API mlz_bool
 mlz_out_stream_close(
 	mlz_out_stream *stream
 );
 
+/* finish current stream (as mlz_out_stream_close) and start new one  */
+/* with new params (handle, callbacks, ...), reusing buffers, matchers */
+/* and mutex; no allocations unless buffer layout changes              */
+/* (block size, independent blocks, jobs, pipelined)                   */
+/* returns MLZ_TRUE on success, on failure stream is freed             */
+MLZ_API mlz_bool
+mlz_out_stream_reset(
+	mlz_out_stream              *stream,
+	MLZ_CONST mlz_stream_params *params,
+	mlz_int                      level
+);
+
 #ifdef __cplusplus
 }
 #endif
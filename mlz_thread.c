@@ -27,6 +27,11 @@
    DEALINGS IN THE SOFTWARE.
 */
 
+/* pthread_setaffinity_np */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#	define _GNU_SOURCE
+#endif
+
 #include "mlz_thread.h"
 #include "mlz_enc.h"
 
@@ -157,10 +162,23 @@ mlz_bool mlz_thread_join(mlz_thread thread)
 	return WaitForSingleObject((HANDLE)thread->handle, INFINITE) == WAIT_OBJECT_0;
 }
 
+static void mlz_thread_yield(void)
+{
+	(void)SwitchToThread();
+}
+
+/* pin calling thread to cpu (first processor group only) */
+static mlz_bool mlz_thread_pin(int cpu)
+{
+	MLZ_RET_FALSE(cpu >= 0 && cpu < (int)(8*sizeof(DWORD_PTR)));
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+}
+
 /* !Windows */
 #else
 
 #	include <pthread.h>
+#	include <sched.h>
 
 mlz_mutex mlz_mutex_create()
 {
@@ -359,69 +377,501 @@ mlz_bool mlz_thread_join(mlz_thread thread)
 	return res;
 }
 
+static void mlz_thread_yield(void)
+{
+	(void)sched_yield();
+}
+
+/* pin calling thread to cpu (not supported everywhere) */
+static mlz_bool mlz_thread_pin(int cpu)
+{
+#if defined(__linux__) && defined(CPU_SET)
+	cpu_set_t set;
+
+	MLZ_RET_FALSE(cpu >= 0 && cpu < CPU_SETSIZE);
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return MLZ_FALSE;
 #endif
+}
 
-static void mlz_job_worker_proc(void *param)
+#endif
+
+enum
 {
-	mlz_job_thread *jt = (mlz_job_thread *)param;
-	mlz_jobs jobs      = jt->jobs;
+	/* initial deque capacity (power of two) */
+	MLZ_JOB_DEQUE_SIZE = 16
+};
+
+/* atomics; without them, mutex passed along guards the value */
+/* and spinning is disabled                                    */
+#if !defined(MLZ_ATOMICS)
+#	if defined(_MSC_VER) || (defined(__GNUC__) && defined(__ATOMIC_SEQ_CST))
+#		define MLZ_ATOMICS 1
+#	else
+#		define MLZ_ATOMICS 0
+#	endif
+#endif
+
+#if MLZ_ATOMICS && defined(_MSC_VER)
+#	include <intrin.h>
+#	pragma intrinsic(_InterlockedExchangeAdd, _InterlockedExchange, _InterlockedOr)
+#	pragma intrinsic(_InterlockedCompareExchange)
+#endif
+
+/* returns new value */
+static long mlz_atomic_add(mlz_atomic *value, long delta, mlz_mutex mutex)
+{
+#if MLZ_ATOMICS && defined(_MSC_VER)
+	(void)mutex;
+	return _InterlockedExchangeAdd(value, delta) + delta;
+#elif MLZ_ATOMICS
+	(void)mutex;
+	return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+#else
+	long res;
+	(void)mlz_mutex_lock(mutex);
+	res = *value += delta;
+	(void)mlz_mutex_unlock(mutex);
+	return res;
+#endif
+}
+
+static long mlz_atomic_load(mlz_atomic *value, mlz_mutex mutex)
+{
+#if MLZ_ATOMICS && defined(_MSC_VER)
+	(void)mutex;
+	return _InterlockedOr(value, 0);
+#elif MLZ_ATOMICS
+	(void)mutex;
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#else
+	long res;
+	(void)mlz_mutex_lock(mutex);
+	res = *value;
+	(void)mlz_mutex_unlock(mutex);
+	return res;
+#endif
+}
+
+static void mlz_atomic_store(mlz_atomic *value, long new_value, mlz_mutex mutex)
+{
+#if MLZ_ATOMICS && defined(_MSC_VER)
+	(void)mutex;
+	(void)_InterlockedExchange(value, new_value);
+#elif MLZ_ATOMICS
+	(void)mutex;
+	__atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+#else
+	(void)mlz_mutex_lock(mutex);
+	*value = new_value;
+	(void)mlz_mutex_unlock(mutex);
+#endif
+}
+
+#if MLZ_ATOMICS
+
+/* returns MLZ_TRUE if value was expected and is now new_value */
+static mlz_bool mlz_atomic_cas(mlz_atomic *value, long expected, long new_value)
+{
+#if defined(_MSC_VER)
+	return _InterlockedCompareExchange(value, new_value, expected) == expected;
+#else
+	return __atomic_compare_exchange_n(value, &expected, new_value, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void *mlz_atomic_load_ptr(void *volatile *ptr)
+{
+#if defined(_MSC_VER)
+	return InterlockedCompareExchangePointer(ptr, MLZ_NULL, MLZ_NULL);
+#else
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void mlz_atomic_store_ptr(void *volatile *ptr, void *new_ptr)
+{
+#if defined(_MSC_VER)
+	(void)InterlockedExchangePointer(ptr, new_ptr);
+#else
+	__atomic_store_n(ptr, new_ptr, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#endif
+
+/* spin-wait hint */
+static void mlz_cpu_relax(void)
+{
+#if defined(_MSC_VER)
+	YieldProcessor();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	__builtin_ia32_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
 
+/* growable ring of jobs, slot i holds job with deque index i */
+typedef struct mlz_job_ring
+{
+	struct mlz_job_ring *next;
+	unsigned long        capacity;
+	mlz_job              slots[1];
+} mlz_job_ring;
+
+#define MLZ_JOB_SLOT(ring, index) (ring)->slots[(unsigned long)(index) & ((ring)->capacity-1)]
+
+/* deque indices wrap around */
+static long mlz_job_index_add(long index, long delta)
+{
+	return (long)((unsigned long)index + (unsigned long)delta);
+}
+
+/* number of jobs in deque */
+static long mlz_job_deque_size(long top, long bottom)
+{
+	return mlz_job_index_add(bottom, -top);
+}
+
+/* replace ring with one twice as large holding jobs top..bottom-1 */
+/* (called with deque lock held)                                    */
+static mlz_bool mlz_job_ring_grow(mlz_jobs jobs, mlz_job_thread *jt, long top, long bottom)
+{
+	mlz_job_ring *old = jt->ring;
+	mlz_job_ring *ring;
+	unsigned long i, capacity = old ? 2*old->capacity : MLZ_JOB_DEQUE_SIZE;
+
+	ring = (mlz_job_ring *)mlz_alloc(jobs->allocator,
+		sizeof(mlz_job_ring) + sizeof(mlz_job)*(capacity-1));
+	MLZ_RET_FALSE(ring);
+
+	ring->next     = MLZ_NULL;
+	ring->capacity = capacity;
+
+	for (i=(unsigned long)top; i!=(unsigned long)bottom; i++)
+		MLZ_JOB_SLOT(ring, i) = MLZ_JOB_SLOT(old, i);
+
+#if MLZ_ATOMICS
+	/* thief may have loaded old ring, so keep it until pool is destroyed */
+	if (old) {
+		old->next   = jt->retired;
+		jt->retired = old;
+	}
+	mlz_atomic_store_ptr((void *volatile *)&jt->ring, ring);
+#else
+	mlz_dealloc(jobs->allocator, old);
+	jt->ring = ring;
+#endif
+	return MLZ_TRUE;
+}
+
+#if MLZ_ATOMICS
+
+/* push job to bottom of worker deque, grows deque if needed; */
+/* pushers lock deque as any thread may enqueue               */
+static mlz_bool mlz_job_deque_push(mlz_jobs jobs, mlz_job_thread *jt, MLZ_CONST mlz_job *job)
+{
+	long bottom, top;
+
+	MLZ_RET_FALSE(mlz_mutex_lock(jt->lock));
+
+	bottom = jt->bottom;
+	top    = mlz_atomic_load(&jt->top, jt->lock);
+
+	if ((!jt->ring || (unsigned long)mlz_job_deque_size(top, bottom) >= jt->ring->capacity) &&
+			!mlz_job_ring_grow(jobs, jt, top, bottom)) {
+		(void)mlz_mutex_unlock(jt->lock);
+		return MLZ_FALSE;
+	}
+
+	/* slot can't hold a job a thief is about to take: */
+	/* deque isn't full, so such thief's CAS fails     */
+	MLZ_JOB_SLOT(jt->ring, bottom) = *job;
+	/* publishes job to thieves */
+	mlz_atomic_store(&jt->bottom, mlz_job_index_add(bottom, 1), jt->lock);
+	(void)mlz_atomic_add(&jobs->queued, 1, jobs->mutex);
+	return mlz_mutex_unlock(jt->lock);
+}
+
+/* owner takes newest job (bottom), races thieves only for the last one */
+static mlz_bool mlz_job_deque_pop(mlz_jobs jobs, mlz_job_thread *jt, mlz_job *job)
+{
+	long     bottom, top, size;
+	mlz_bool res = MLZ_TRUE;
+
+	if (!mlz_mutex_lock(jt->lock))
+		return MLZ_FALSE;
+
+	/* reserve bottom job before looking at top */
+	bottom = mlz_job_index_add(jt->bottom, -1);
+	mlz_atomic_store(&jt->bottom, bottom, jt->lock);
+	top  = mlz_atomic_load(&jt->top, jt->lock);
+	size = mlz_job_deque_size(top, bottom);
+
+	if (size < 0) {
+		mlz_atomic_store(&jt->bottom, mlz_job_index_add(bottom, 1), jt->lock);
+		(void)mlz_mutex_unlock(jt->lock);
+		return MLZ_FALSE;
+	}
+
+	*job = MLZ_JOB_SLOT(jt->ring, bottom);
+
+	if (!size) {
+		/* last job: whoever moves top takes it */
+		res = mlz_atomic_cas(&jt->top, top, mlz_job_index_add(top, 1));
+		mlz_atomic_store(&jt->bottom, mlz_job_index_add(bottom, 1), jt->lock);
+	}
+
+	if (res)
+		(void)mlz_atomic_add(&jobs->queued, -1, jobs->mutex);
+
+	(void)mlz_mutex_unlock(jt->lock);
+	return res;
+}
+
+/* thief takes oldest job (top) without locking */
+static mlz_bool mlz_job_deque_steal(mlz_jobs jobs, mlz_job_thread *jt, mlz_job *job)
+{
 	for (;;) {
-		mlz_bool done;
+		long          top    = mlz_atomic_load(&jt->top, jt->lock);
+		long          bottom = mlz_atomic_load(&jt->bottom, jt->lock);
+		mlz_job_ring *ring;
 
-		(void)mlz_event_wait(jt->event);
-		(void)mlz_event_reset(jt->event);
-		if (jt->stop)
-			break;
-		MLZ_ASSERT(jt->job.job);
-		jt->job.job(jt->job.idx, jt->job.param);
+		if (mlz_job_deque_size(top, bottom) <= 0)
+			return MLZ_FALSE;
+
+		/* ring loaded after bottom holds all jobs up to bottom */
+		ring = (mlz_job_ring *)mlz_atomic_load_ptr((void *volatile *)&jt->ring);
+		*job = MLZ_JOB_SLOT(ring, top);
+
+		/* otherwise job taken by owner or another thief, retry */
+		if (mlz_atomic_cas(&jt->top, top, mlz_job_index_add(top, 1))) {
+			(void)mlz_atomic_add(&jobs->queued, -1, jobs->mutex);
+			return MLZ_TRUE;
+		}
+	}
+}
 
-		MLZ_ASSERT(jobs->running);
+/* !MLZ_ATOMICS: deque lock guards everything */
+#else
+
+static mlz_bool mlz_job_deque_push(mlz_jobs jobs, mlz_job_thread *jt, MLZ_CONST mlz_job *job)
+{
+	MLZ_RET_FALSE(mlz_mutex_lock(jt->lock));
+
+	if ((!jt->ring || (unsigned long)mlz_job_deque_size(jt->top, jt->bottom) >= jt->ring->capacity) &&
+			!mlz_job_ring_grow(jobs, jt, jt->top, jt->bottom)) {
+		(void)mlz_mutex_unlock(jt->lock);
+		return MLZ_FALSE;
+	}
+
+	MLZ_JOB_SLOT(jt->ring, jt->bottom) = *job;
+	jt->bottom = mlz_job_index_add(jt->bottom, 1);
+	(void)mlz_atomic_add(&jobs->queued, 1, jobs->mutex);
+	return mlz_mutex_unlock(jt->lock);
+}
 
+static mlz_bool mlz_job_deque_take(mlz_jobs jobs, mlz_job_thread *jt, mlz_job *job, mlz_bool steal)
+{
+	mlz_bool res = MLZ_FALSE;
+
+	if (!mlz_mutex_lock(jt->lock))
+		return MLZ_FALSE;
+
+	if (mlz_job_deque_size(jt->top, jt->bottom) > 0) {
+		if (steal) {
+			*job    = MLZ_JOB_SLOT(jt->ring, jt->top);
+			jt->top = mlz_job_index_add(jt->top, 1);
+		} else {
+			jt->bottom = mlz_job_index_add(jt->bottom, -1);
+			*job       = MLZ_JOB_SLOT(jt->ring, jt->bottom);
+		}
+		(void)mlz_atomic_add(&jobs->queued, -1, jobs->mutex);
+		res = MLZ_TRUE;
+	}
+
+	(void)mlz_mutex_unlock(jt->lock);
+	return res;
+}
+
+static mlz_bool mlz_job_deque_pop(mlz_jobs jobs, mlz_job_thread *jt, mlz_job *job)
+{
+	return mlz_job_deque_take(jobs, jt, job, MLZ_FALSE);
+}
+
+static mlz_bool mlz_job_deque_steal(mlz_jobs jobs, mlz_job_thread *jt, mlz_job *job)
+{
+	return mlz_job_deque_take(jobs, jt, job, MLZ_TRUE);
+}
+
+#endif
+
+/* get job from own deque or steal from others; self = -1: not a worker */
+static mlz_bool mlz_jobs_get(mlz_jobs jobs, int self, mlz_job *job)
+{
+	int i;
+
+	if (self >= 0 && mlz_job_deque_pop(jobs, jobs->thread + self, job))
+		return MLZ_TRUE;
+
+	/* don't lock deques for nothing */
+	if (!mlz_atomic_load(&jobs->queued, jobs->mutex))
+		return MLZ_FALSE;
+
+	for (i=1; i<=jobs->num_threads; i++) {
+		int victim = (self + i) % jobs->num_threads;
+
+		if (victim != self && mlz_job_deque_steal(jobs, jobs->thread + victim, job))
+			return MLZ_TRUE;
+	}
+
+	return MLZ_FALSE;
+}
+
+/* run job and signal completion of its batch after last one */
+static void mlz_jobs_run(MLZ_CONST mlz_job *job)
+{
+	mlz_batch *batch = job->batch;
+
+	MLZ_ASSERT(batch->running);
+	job->job(job->idx, job->param);
+
+	if (!mlz_atomic_add(&batch->pending, -1, batch->mutex)) {
+		(void)mlz_event_set(batch->done_event);
+		/* last access, waiter may destroy batch right after */
+		mlz_atomic_store(&batch->done, 1, batch->mutex);
+	}
+}
+
+static void mlz_job_worker_proc(void *param)
+{
+	mlz_job_thread *jt = (mlz_job_thread *)param;
+	mlz_jobs jobs      = jt->jobs;
+	int      self      = (int)(jt - jobs->thread);
+
+	if (jobs->cpus)
+		(void)mlz_thread_pin(jobs->cpus[self % jobs->num_cpus]);
+
+	if (jobs->cpus) {
 		(void)mlz_mutex_lock(jobs->mutex);
-		MLZ_ASSERT(jt->active);
-		jt->active = MLZ_FALSE;
-		done = !--jobs->active_threads;
+		if (++jobs->ready == jobs->num_threads)
+			(void)mlz_event_set(jobs->ready_event);
 		(void)mlz_mutex_unlock(jobs->mutex);
+	}
+
+	for (;;) {
+		mlz_job  job;
+		mlz_bool stop;
+		int      i;
+
+		/* drain own deque, then help others */
+		while (mlz_jobs_get(jobs, self, &job))
+			mlz_jobs_run(&job);
+
+		/* low latency: new jobs may be just about to come */
+		for (i=0; i<jobs->spin_count && !mlz_atomic_load(&jobs->queued, jobs->mutex); i++)
+			mlz_cpu_relax();
+
+		/* enqueue pushes, then checks parked; we set parked, then */
+		/* check queued, so one of us always sees the other        */
+		mlz_atomic_store(&jt->parked, 1, jt->lock);
+		if (!mlz_atomic_load(&jobs->queued, jobs->mutex))
+			(void)mlz_event_wait(jt->event);
+
+		/* event is reset before deques are checked again, */
+		/* so a job pushed in the meantime isn't missed      */
+		(void)mlz_event_reset(jt->event);
+		mlz_atomic_store(&jt->parked, 0, jt->lock);
 
-		if (done)
-			(void)mlz_event_set(jobs->queue_done_event);
+		(void)mlz_mutex_lock(jt->lock);
+		stop = jt->stop;
+		(void)mlz_mutex_unlock(jt->lock);
+		if (stop)
+			break;
 	}
 }
 
+MLZ_CONST mlz_jobs_options mlz_default_jobs_options = {
+	/* allocator (mlz_malloc) */
+	MLZ_NULL,
+	/* cpus (no pinning) */
+	MLZ_NULL,
+	/* num_cpus */
+	0,
+	/* spin_count (park immediately) */
+	0
+};
+
 mlz_jobs mlz_jobs_create(int num_threads)
+{
+	return mlz_jobs_create_ex(num_threads, MLZ_NULL);
+}
+
+mlz_jobs mlz_jobs_create_ex(int num_threads, MLZ_CONST mlz_jobs_options *options)
 {
 	mlz_jobs res;
 	int      i;
 	size_t   size = sizeof(struct mlz_jobs) + sizeof(mlz_job_thread)*(num_threads-1);
 
+	if (!options)
+		options = &mlz_default_jobs_options;
+
 	MLZ_RET_FALSE(num_threads > 0);
-	res = (mlz_jobs)mlz_malloc(size);
+	MLZ_RET_FALSE(!options->cpus || options->num_cpus > 0);
+	res = (mlz_jobs)mlz_alloc(options->allocator, size);
 	MLZ_RET_FALSE(res);
 
 	memset(res, 0, size);
+	res->allocator  = options->allocator;
+	res->cpus       = options->cpus;
+	res->num_cpus   = options->num_cpus;
+	res->spin_count = MLZ_ATOMICS ? options->spin_count : 0;
 
-	res->mutex            = mlz_mutex_create();
-	res->queue_done_event = mlz_event_create();
+	res->mutex       = mlz_mutex_create();
+	res->ready_event = mlz_event_create();
 
-	if (!res->mutex || !res->queue_done_event || !mlz_event_reset(res->queue_done_event)) {
+	if (!res->mutex || !res->ready_event || !mlz_event_reset(res->ready_event) ||
+			!mlz_batch_init(&res->batch)) {
 		(void)mlz_jobs_destroy(res);
 		return MLZ_NULL;
 	}
 
+	/* all deques must exist before any worker starts stealing */
 	for (i=0; i<num_threads; i++) {
 		mlz_job_thread *jt = res->thread + i;
-		jt->jobs = res;
+		jt->jobs  = res;
+		jt->lock  = mlz_mutex_create();
 		jt->event = mlz_event_create();
+
+		res->num_threads = i+1;
+
+		if (!jt->lock || !jt->event || !mlz_event_reset(jt->event)) {
+			(void)mlz_jobs_destroy(res);
+			return MLZ_NULL;
+		}
+	}
+
+	for (i=0; i<num_threads; i++) {
+		mlz_job_thread *jt = res->thread + i;
 		jt->thread = mlz_thread_create();
 
-		if (!jt->event || !jt->thread || !mlz_thread_run(jt->thread, mlz_job_worker_proc, jt)) {
+		if (!jt->thread || !mlz_thread_run(jt->thread, mlz_job_worker_proc, jt)) {
 			(void)mlz_jobs_destroy(res);
 			return MLZ_NULL;
 		}
 	}
 
-	res->num_threads = num_threads;
+	/* wait until workers are pinned */
+	if (res->cpus && !mlz_event_wait(res->ready_event)) {
+		(void)mlz_jobs_destroy(res);
+		return MLZ_NULL;
+	}
 
 	return res;
 }
@@ -437,19 +887,43 @@ mlz_bool mlz_jobs_destroy(mlz_jobs jobs)
 		mlz_job_thread *jt = jobs->thread + i;
 
 		if (jt->thread) {
+			MLZ_RET_FALSE(mlz_mutex_lock(jt->lock));
 			jt->stop = MLZ_TRUE;
+			MLZ_RET_FALSE(mlz_mutex_unlock(jt->lock));
 			MLZ_RET_FALSE(mlz_event_set(jt->event) && mlz_thread_join(jt->thread));
 			MLZ_RET_FALSE(mlz_thread_destroy(jt->thread));
 			jt->thread = MLZ_NULL;
 		}
+	}
+
+	for (i=0; i<jobs->num_threads; i++) {
+		mlz_job_thread *jt = jobs->thread + i;
+
+		if (jt->event) {
+			MLZ_RET_FALSE(mlz_event_destroy(jt->event));
+			jt->event = MLZ_NULL;
+		}
+
+		if (jt->lock) {
+			MLZ_RET_FALSE(mlz_mutex_destroy(jt->lock));
+			jt->lock = MLZ_NULL;
+		}
+
+		while (jt->retired) {
+			mlz_job_ring *next = jt->retired->next;
+			mlz_dealloc(jobs->allocator, jt->retired);
+			jt->retired = next;
+		}
 
-		MLZ_RET_FALSE(mlz_event_destroy(jt->event));
-		jt->event = MLZ_NULL;
+		mlz_dealloc(jobs->allocator, jt->ring);
+		jt->ring = MLZ_NULL;
 	}
 
-	if (jobs->queue_done_event) {
-		MLZ_RET_FALSE(mlz_event_destroy(jobs->queue_done_event));
-		jobs->queue_done_event = MLZ_NULL;
+	MLZ_RET_FALSE(mlz_batch_destroy(&jobs->batch));
+
+	if (jobs->ready_event) {
+		MLZ_RET_FALSE(mlz_event_destroy(jobs->ready_event));
+		jobs->ready_event = MLZ_NULL;
 	}
 
 	if (jobs->mutex) {
@@ -457,63 +931,150 @@ mlz_bool mlz_jobs_destroy(mlz_jobs jobs)
 		jobs->mutex = MLZ_NULL;
 	}
 
-	mlz_free(jobs);
+	mlz_dealloc(jobs->allocator, jobs);
 	return MLZ_TRUE;
 }
 
-mlz_bool mlz_jobs_enqueue(mlz_jobs jobs, mlz_job job)
+mlz_bool mlz_batch_init(mlz_batch *batch)
 {
-	mlz_bool set_running = MLZ_FALSE;
+	MLZ_RET_FALSE(batch);
 
-	MLZ_RET_FALSE(jobs && job.job);
+	batch->pending    = 0;
+	batch->done       = 0;
+	batch->running    = MLZ_FALSE;
+	batch->mutex      = mlz_mutex_create();
+	batch->done_event = mlz_event_create();
 
-	if (!jobs->running) {
-		MLZ_RET_FALSE(mlz_event_reset(jobs->queue_done_event));
-		set_running = jobs->running = MLZ_TRUE;
+	if (!batch->mutex || !batch->done_event || !mlz_event_reset(batch->done_event)) {
+		(void)mlz_batch_destroy(batch);
+		return MLZ_FALSE;
 	}
 
-	MLZ_RET_FALSE(mlz_mutex_lock(jobs->mutex));
+	return MLZ_TRUE;
+}
 
-	{
-		mlz_bool res;
-		mlz_job_thread *jt = jobs->thread;
+mlz_bool mlz_batch_destroy(mlz_batch *batch)
+{
+	MLZ_RET_FALSE(batch && !batch->running);
+
+	if (batch->mutex) {
+		MLZ_RET_FALSE(mlz_mutex_destroy(batch->mutex));
+		batch->mutex = MLZ_NULL;
+	}
 
-		while (jt->active)
-			++jt;
+	if (batch->done_event) {
+		MLZ_RET_FALSE(mlz_event_destroy(batch->done_event));
+		batch->done_event = MLZ_NULL;
+	}
 
-		MLZ_ASSERT(jt - jobs->thread < jobs->num_threads);
+	return MLZ_TRUE;
+}
 
-		jt->active = MLZ_TRUE;
-		jt->job    = job;
+mlz_bool mlz_jobs_enqueue_ex(mlz_jobs jobs, mlz_batch *batch, mlz_job job)
+{
+	mlz_job_thread *jt;
+	mlz_bool        set_running = MLZ_FALSE;
+	int             i, target;
 
-		res = mlz_mutex_unlock(jobs->mutex) && mlz_event_set(jt->event);
-		if (!res && set_running)
-			jobs->running = MLZ_FALSE;
+	MLZ_RET_FALSE(jobs && batch && job.job);
 
-		return res;
+	if (!batch->running) {
+		MLZ_RET_FALSE(mlz_event_reset(batch->done_event));
+		set_running = batch->running = MLZ_TRUE;
+	}
+
+	job.batch = batch;
+
+	/* spread jobs round-robin, idle workers steal the rest */
+	target = (int)((unsigned long)mlz_atomic_add(&jobs->next_thread, 1, jobs->mutex) %
+		(unsigned long)jobs->num_threads);
+	jt = jobs->thread + target;
+
+	/* out of memory growing deque: run job here, batch stays consistent */
+	if (!mlz_job_deque_push(jobs, jt, &job)) {
+		mlz_jobs_run(&job);
+		return MLZ_TRUE;
+	}
+
+	/* worker not parked will find the job itself; if it's busy with */
+	/* another job, wake one parked worker to steal this one          */
+	for (i=1; i<jobs->num_threads && !mlz_atomic_load(&jt->parked, jt->lock); i++)
+		jt = jobs->thread + (target + i) % jobs->num_threads;
+
+	if (mlz_atomic_load(&jt->parked, jt->lock) && !mlz_event_set(jt->event)) {
+		if (set_running)
+			batch->running = MLZ_FALSE;
+		return MLZ_FALSE;
 	}
+
+	return MLZ_TRUE;
 }
 
-mlz_bool mlz_jobs_prepare_batch(
-	mlz_jobs jobs,
-	mlz_int  num_threads
+mlz_bool mlz_jobs_prepare_batch_ex(
+	mlz_jobs   jobs,
+	mlz_batch *batch,
+	mlz_int    num_jobs
 )
 {
-	MLZ_RET_FALSE(jobs && mlz_mutex_lock(jobs->mutex));
+	MLZ_RET_FALSE(jobs && batch);
 
-	MLZ_ASSERT(num_threads >= 0);
-	jobs->active_threads = num_threads;
+	MLZ_ASSERT(num_jobs >= 0 && !batch->running);
+	mlz_atomic_store(&batch->done, 0, batch->mutex);
+	mlz_atomic_store(&batch->pending, num_jobs, batch->mutex);
 
-	return mlz_mutex_unlock(jobs->mutex);
+	return MLZ_TRUE;
+}
+
+mlz_bool mlz_jobs_wait_ex(mlz_jobs jobs, mlz_batch *batch)
+{
+	mlz_bool res = MLZ_TRUE;
+	mlz_job  job;
+	int      i;
+
+	MLZ_RET_FALSE(jobs && batch);
+
+	if (!batch->running)
+		return MLZ_TRUE;
+
+	/* this thread helps with jobs not started yet (of any batch, */
+	/* but only as long as its own batch isn't done)              */
+	while (mlz_atomic_load(&batch->pending, batch->mutex) > 0 && mlz_jobs_get(jobs, -1, &job))
+		mlz_jobs_run(&job);
+
+	/* low latency: last jobs may be about to finish */
+	for (i=0; i<jobs->spin_count && !mlz_atomic_load(&batch->done, batch->mutex); i++)
+		mlz_cpu_relax();
+
+	if (!mlz_atomic_load(&batch->done, batch->mutex))
+		res = mlz_event_wait(batch->done_event);
+
+	/* event is set just before done */
+	while (res && !mlz_atomic_load(&batch->done, batch->mutex))
+		mlz_thread_yield();
+
+	batch->running = MLZ_FALSE;
+	return res;
+}
+
+mlz_bool mlz_jobs_enqueue(mlz_jobs jobs, mlz_job job)
+{
+	MLZ_RET_FALSE(jobs);
+	return mlz_jobs_enqueue_ex(jobs, &jobs->batch, job);
+}
+
+mlz_bool mlz_jobs_prepare_batch(
+	mlz_jobs jobs,
+	mlz_int  num_jobs
+)
+{
+	MLZ_RET_FALSE(jobs);
+	return mlz_jobs_prepare_batch_ex(jobs, &jobs->batch, num_jobs);
 }
 
 mlz_bool mlz_jobs_wait(mlz_jobs jobs)
 {
-	mlz_bool res;
 	MLZ_RET_FALSE(jobs);
-	res = !jobs->running || mlz_event_wait(jobs->queue_done_event);
-	jobs->running = MLZ_FALSE;
-	return res;
+	return mlz_jobs_wait_ex(jobs, &jobs->batch);
 }
 
 #endif
@@ -44,6 +44,9 @@ typedef void *mlz_mutex;
 /* event (=mutex + condition variable) */
 typedef void *mlz_event;
 
+/* integer updated atomically (by mutex where atomics are unavailable) */
+typedef volatile long mlz_atomic;
+
 /* thread procedure */
 typedef void (*mlz_thread_proc)(void *param);
 
@@ -83,43 +86,122 @@ MLZ_API mlz_bool mlz_thread_join    (mlz_thread thread);
 
 typedef void (*mlz_job_proc)(int thread, void *param);
 
+/* completion state of a group of jobs; any number of batches can */
+/* share one pool, each is waited for independently               */
+typedef struct mlz_batch
+{
+	/* jobs not finished yet */
+	mlz_atomic pending;
+	/* last job finished signalling (batch no longer used by workers) */
+	mlz_atomic done;
+	mlz_bool   running;
+	mlz_mutex  mutex;
+	/* set when last job finishes */
+	mlz_event  done_event;
+} mlz_batch;
+
 typedef struct
 {
-	mlz_job_proc job;
-	void        *param;
-	int          idx;
+	mlz_job_proc      job;
+	void             *param;
+	int               idx;
+	/* set by enqueue */
+	struct mlz_batch *batch;
 } mlz_job;
 
 struct mlz_jobs;
+struct mlz_allocator;
+struct mlz_job_ring;
 
+/* worker with its own job deque; the worker takes newest jobs */
+/* from bottom, idle workers steal oldest ones from top         */
+/* (Chase-Lev: with atomics, thieves don't lock the deque)     */
 typedef struct
 {
 	struct mlz_jobs *jobs;
-	mlz_job          job;
 	mlz_thread       thread;
+	/* signalled when job is pushed to deque (or stop) */
 	mlz_event        event;
+	/* worker waits on event (set only then) */
+	mlz_atomic       parked;
 	mlz_bool         stop;
-	mlz_bool         active;
+	/* serializes pushes and own pops (and steals without atomics) */
+	mlz_mutex        lock;
+	/* deque: jobs top..bottom-1 (indices only grow) in ring buffer */
+	struct mlz_job_ring *volatile ring;
+	/* rings replaced by larger ones (thieves may still read them) */
+	struct mlz_job_ring *retired;
+	mlz_atomic       top;
+	mlz_atomic       bottom;
 } mlz_job_thread;
 
 typedef struct mlz_jobs
 {
+	MLZ_CONST struct mlz_allocator *allocator;
 	int            num_threads;
-	int            active_threads;
-	mlz_bool       running;
+	/* worker to receive next job (modulo num_threads) */
+	mlz_atomic     next_thread;
+	/* jobs in all deques */
+	mlz_atomic     queued;
+	int            spin_count;
 	mlz_mutex      mutex;
-	mlz_event      queue_done_event;
+	/* workers done with startup (pinning) */
+	int            ready;
+	mlz_event      ready_event;
+	MLZ_CONST int *cpus;
+	int            num_cpus;
+	/* batch used by mlz_jobs_prepare_batch/enqueue/wait */
+	mlz_batch      batch;
 	mlz_job_thread thread[1];
 } *mlz_jobs;
 
+/* job pool options */
+typedef struct
+{
+	/* allocator for pool memory (see mlz_enc.h), null = mlz_malloc */
+	MLZ_CONST struct mlz_allocator *allocator;
+	/* pin worker i to cpus[i % num_cpus] (best effort), null = no pinning */
+	/* (only read while mlz_jobs_create_ex runs)                           */
+	MLZ_CONST int                  *cpus;
+	int                             num_cpus;
+	/* low latency: idle workers and waiting threads spin this many times */
+	/* before parking (0 = park immediately), useful for small blocks    */
+	/* (spinning needs atomics, see MLZ_ATOMICS in mlz_thread.c)          */
+	int                             spin_count;
+} mlz_jobs_options;
+
+enum
+{
+	/* spin_count suggested for low latency mode */
+	MLZ_JOBS_LOW_LATENCY_SPIN = 4096
+};
+
+extern MLZ_API MLZ_CONST mlz_jobs_options mlz_default_jobs_options;
+
 /* returns MLZ_NULL on failure */
 MLZ_API mlz_jobs mlz_jobs_create (int num_threads);
+/* options can be MLZ_NULL (defaults) */
+MLZ_API mlz_jobs mlz_jobs_create_ex(int num_threads, MLZ_CONST mlz_jobs_options *options);
 /* returns MLZ_FALSE on failure */
 MLZ_API mlz_bool mlz_jobs_destroy(mlz_jobs jobs);
-MLZ_API mlz_bool mlz_jobs_prepare_batch(mlz_jobs jobs, mlz_int num_threads);
+/* batch: prepare_batch with number of jobs to be enqueued, enqueue them */
+/* (any number, jobs are balanced among workers by stealing), wait     */
+/* these use pool's own batch, so only one user at a time              */
+MLZ_API mlz_bool mlz_jobs_prepare_batch(mlz_jobs jobs, mlz_int num_jobs);
 MLZ_API mlz_bool mlz_jobs_enqueue(mlz_jobs jobs, mlz_job job);
+/* waiting thread runs jobs not started yet */
 MLZ_API mlz_bool mlz_jobs_wait   (mlz_jobs jobs);
 
+/* returns MLZ_FALSE on failure */
+MLZ_API mlz_bool mlz_batch_init   (mlz_batch *batch);
+/* batch must not be running */
+MLZ_API mlz_bool mlz_batch_destroy(mlz_batch *batch);
+/* same as above for a batch owned by caller; concurrent users of a pool */
+/* (e.g. streams sharing params.jobs) each use their own batch          */
+MLZ_API mlz_bool mlz_jobs_prepare_batch_ex(mlz_jobs jobs, mlz_batch *batch, mlz_int num_jobs);
+MLZ_API mlz_bool mlz_jobs_enqueue_ex(mlz_jobs jobs, mlz_batch *batch, mlz_job job);
+MLZ_API mlz_bool mlz_jobs_wait_ex   (mlz_jobs jobs, mlz_batch *batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,11 @@
 #	define _CRT_SECURE_NO_WARNINGS
 #endif
 
+/* fseeko/ftello with 64-bit offsets on 32-bit systems */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_FILE_OFFSET_BITS)
+#	define _FILE_OFFSET_BITS 64
+#endif
+
 /* very simple command line tool, demonstrates streaming API */
 /* FIXME: clean up                                           */
 
@@ -47,6 +52,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#	include <windows.h>
+#	include <io.h>
+#	define MLZC_MMAP
+#elif defined(__unix__) || defined(__APPLE__)
+#	include <sys/types.h>
+#	include <sys/stat.h>
+#	include <sys/mman.h>
+#	define MLZC_MMAP
+#endif
+
 static MLZ_CONST char *in_file  = MLZ_NULL;
 static MLZ_CONST char *out_file = MLZ_NULL;
 static int level                = MLZ_LEVEL_MAX;
@@ -58,16 +74,143 @@ static mlz_bool test            = MLZ_FALSE;
 static mlz_bool independent     = MLZ_FALSE;
 /* use compressed block checksum */
 static mlz_bool block_checksum  = MLZ_FALSE;
+/* checksum algorithm (MLZ_CHECKSUM_*) */
+static mlz_int  checksum_type   = MLZ_CHECKSUM_ADLER32;
 static mlz_bool show_ver        = MLZ_FALSE;
 static mlz_bool unsafe          = MLZ_FALSE;
 static mlz_bool raw             = MLZ_FALSE;
 static mlz_bool raw_mem         = MLZ_FALSE;
+/* segmented raw memory container */
+static mlz_bool raw_par         = MLZ_FALSE;
 static mlz_int  block_size      = 65536;
+/* adaptive block size: minimum block size (0 = off) */
+static mlz_int  min_block_size  = 0;
+/* sync point every n blocks (0 = none) */
+static mlz_int  sync_interval   = 0;
+/* write block index */
+static mlz_bool use_index       = MLZ_FALSE;
+/* store content size in header */
+static mlz_bool content_size    = MLZ_FALSE;
+/* decompress from uncompressed offset */
+static mlz_long offset          = 0;
+/* decompress from memory-mapped infile if possible */
+static mlz_bool use_mmap        = MLZ_TRUE;
+/* allocator for stream buffers, MLZ_NULL = mlz_malloc */
+static MLZ_CONST mlz_allocator *allocator = MLZ_NULL;
 #if defined(MLZ_THREADS)
+/* library has no limit, but more threads than this is surely a typo */
+#define MLZC_MAX_THREADS 1024
 static mlz_int  num_threads     = 1;
+/* pipelined multi-threaded compression */
+static mlz_bool pipelined       = MLZ_FALSE;
+/* read input in background when decompressing */
+static mlz_bool async_read      = MLZ_FALSE;
+/* workers spin a while before sleeping */
+static mlz_bool low_latency     = MLZ_FALSE;
+#define MLZC_MAX_CPUS 1024
+/* cpus to pin worker threads to (0 = no pinning) */
+static int      cpus[MLZC_MAX_CPUS];
+static int      num_cpus        = 0;
+
+/* parse cpu list, e.g. 0-7,16-23 */
+static mlz_bool parse_cpus(MLZ_CONST char *str)
+{
+	num_cpus = 0;
+
+	for (;;) {
+		char *end;
+		long  first, last;
+
+		first = last = strtol(str, &end, 10);
+		MLZ_RET_FALSE(end != str && first >= 0);
+		str = end;
+
+		if (*str == '-') {
+			last = strtol(++str, &end, 10);
+			MLZ_RET_FALSE(end != str && last >= first);
+			str = end;
+		}
+
+		for (; first <= last; first++) {
+			MLZ_RET_FALSE(num_cpus < MLZC_MAX_CPUS);
+			cpus[num_cpus++] = (int)first;
+		}
+
+		if (!*str)
+			break;
+
+		MLZ_RET_FALSE(*str++ == ',');
+	}
+
+	return MLZ_TRUE;
+}
+#endif
+
+/* parse non-negative 64-bit offset (strtol is only 32-bit on Windows) */
+static mlz_bool parse_offset(MLZ_CONST char *str, mlz_long *value)
+{
+	mlz_long res = 0;
+	mlz_long max = (mlz_long)(~(mlz_ulong)0 >> 1);
+
+	MLZ_RET_FALSE(*str);
+
+	for (; *str; str++) {
+		MLZ_RET_FALSE(*str >= '0' && *str <= '9' && res <= (max - (*str - '0'))/10);
+		res = res*10 + (*str - '0');
+	}
+
+	*value = res;
+	return MLZ_TRUE;
+}
+
+/* 64-bit file offsets (long is 32-bit on Windows) */
+static int file_seek(FILE *f, mlz_long offset, int origin)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+	return _fseeki64(f, offset, origin);
+#elif defined(__unix__) || defined(__APPLE__)
+	return fseeko(f, (off_t)offset, origin);
+#else
+	return fseek(f, (long)offset, origin);
 #endif
+}
+
+static mlz_long file_tell(FILE *f)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+	return _ftelli64(f);
+#elif defined(__unix__) || defined(__APPLE__)
+	return (mlz_long)ftello(f);
+#else
+	return (mlz_long)ftell(f);
+#endif
+}
+
+/* size of file opened for reading, position is reset to start */
+static mlz_long file_size(FILE *f)
+{
+	mlz_long res;
+
+	(void)file_seek(f, 0, SEEK_END);
+	res = file_tell(f);
+	(void)file_seek(f, 0, SEEK_SET);
+	return res;
+}
 
-static char buffer[65536];
+static void set_checksum(mlz_stream_params *par)
+{
+	MLZ_CONST mlz_checksum_info *info = mlz_get_checksum_info(checksum_type);
+
+	if (block_checksum) {
+		par->block_checksum   = info->block_checksum;
+		par->block_checksum64 = info->block_checksum64;
+	}
+	if (info->incremental_checksum) {
+		par->incremental_checksum = info->incremental_checksum;
+		par->combine_checksum     = info->combine_checksum;
+		par->initial_checksum     = info->initial_checksum;
+	}
+}
 
 static int parse_args(int argc, char **argv)
 {
@@ -100,6 +243,8 @@ static int parse_args(int argc, char **argv)
 			raw = MLZ_TRUE;
 		} else if (strcmp(argv[i], "-rm") == 0 || strcmp(argv[i], "--raw-memory") == 0) {
 			raw_mem = MLZ_TRUE;
+		} else if (strcmp(argv[i], "-rp") == 0 || strcmp(argv[i], "--raw-parallel") == 0) {
+			raw_par = MLZ_TRUE;
 		} else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--compress") == 0) {
 			compress = MLZ_TRUE;
 		} else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--decompress") == 0) {
@@ -110,6 +255,22 @@ static int parse_args(int argc, char **argv)
 			test = MLZ_TRUE;
 		} else if (strcmp(argv[i], "-bc") == 0 || strcmp(argv[i], "--block-checksum") == 0) {
 			block_checksum = MLZ_TRUE;
+		} else if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--checksum") == 0) {
+			if (i+1 >= argc) {
+				(void)fprintf(stderr, "checksum expects argument\n");
+				return 2;
+			}
+			++i;
+			if (strcmp(argv[i], "adler32") == 0)
+				checksum_type = MLZ_CHECKSUM_ADLER32;
+			else if (strcmp(argv[i], "xxh64") == 0)
+				checksum_type = MLZ_CHECKSUM_XXH64;
+			else if (strcmp(argv[i], "crc32c") == 0)
+				checksum_type = MLZ_CHECKSUM_CRC32C;
+			else {
+				(void)fprintf(stderr, "invalid checksum: %s\n", argv[i]);
+				return 2;
+			}
 		} else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--independent") == 0) {
 			independent = MLZ_TRUE;
 		} else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--block") == 0) {
@@ -125,17 +286,76 @@ static int parse_args(int argc, char **argv)
 				return 2;
 			}
 			block_size = (mlz_int)ablock_size;
+		} else if (strcmp(argv[i], "-B") == 0 || strcmp(argv[i], "--min-block") == 0) {
+			long ablock_size;
+			if (i+1 >= argc) {
+				(void)fprintf(stderr, "min block size expects argument\n");
+				return 2;
+			}
+			ablock_size = strtol(argv[++i], MLZ_NULL, 10);
+			ablock_size *= 1024;
+			if (ablock_size < MLZ_MIN_BLOCK_SIZE || ablock_size > MLZ_MAX_BLOCK_SIZE) {
+				(void)fprintf(stderr, "invalid min block size: %ld\n", ablock_size);
+				return 2;
+			}
+			min_block_size = (mlz_int)ablock_size;
+		} else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--sync") == 0) {
+			long async_interval;
+			if (i+1 >= argc) {
+				(void)fprintf(stderr, "sync interval expects argument\n");
+				return 2;
+			}
+			async_interval = strtol(argv[++i], MLZ_NULL, 10);
+			if (async_interval < 0 || async_interval > MLZ_MAX_BLOCK_SIZE/MLZ_MIN_BLOCK_SIZE) {
+				(void)fprintf(stderr, "invalid sync interval: %ld\n", async_interval);
+				return 2;
+			}
+			sync_interval = (mlz_int)async_interval;
+		} else if (strcmp(argv[i], "-x") == 0 || strcmp(argv[i], "--index") == 0) {
+			use_index = MLZ_TRUE;
+		} else if (strcmp(argv[i], "-nm") == 0 || strcmp(argv[i], "--no-mmap") == 0) {
+			use_mmap = MLZ_FALSE;
+		} else if (strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "--huge-pages") == 0) {
+			allocator = &mlz_huge_page_allocator;
+		} else if (strcmp(argv[i], "-z") == 0 || strcmp(argv[i], "--content-size") == 0) {
+			content_size = MLZ_TRUE;
+		} else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--offset") == 0) {
+			if (i+1 >= argc) {
+				(void)fprintf(stderr, "offset expects argument\n");
+				return 2;
+			}
+			if (!parse_offset(argv[++i], &offset)) {
+				(void)fprintf(stderr, "invalid offset: %s\n", argv[i]);
+				return 2;
+			}
 #if defined(MLZ_THREADS)
 		} else if (strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "--threads") == 0) {
+			long value;
 			if (i+1 >= argc) {
 				(void)fprintf(stderr, "threads expect argument\n");
 				return 2;
 			}
-			num_threads = (mlz_int)strtol(argv[++i], MLZ_NULL, 10);
-			if (num_threads < 1 || num_threads > MLZ_MAX_THREADS) {
-				(void)fprintf(stderr, "invalid number of threads: %d\n", (int)num_threads);
+			value = strtol(argv[++i], MLZ_NULL, 10);
+			if (value < 1 || value > MLZC_MAX_THREADS) {
+				(void)fprintf(stderr, "invalid number of threads: %s (1-%d)\n", argv[i], MLZC_MAX_THREADS);
+				return 2;
+			}
+			num_threads = (mlz_int)value;
+		} else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--pipeline") == 0) {
+			pipelined = MLZ_TRUE;
+		} else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--async-read") == 0) {
+			async_read = MLZ_TRUE;
+		} else if (strcmp(argv[i], "-A") == 0 || strcmp(argv[i], "--affinity") == 0) {
+			if (i+1 >= argc) {
+				(void)fprintf(stderr, "affinity expects argument\n");
+				return 2;
+			}
+			if (!parse_cpus(argv[++i])) {
+				(void)fprintf(stderr, "invalid cpu list: `%s'\n", argv[i]);
 				return 2;
 			}
+		} else if (strcmp(argv[i], "-L") == 0 || strcmp(argv[i], "--low-latency") == 0) {
+			low_latency = MLZ_TRUE;
 #endif
 		} else {
 			(void)fprintf(stderr, "invalid argument: `%s'\n", argv[i]);
@@ -167,17 +387,36 @@ static void help(void)
 	printf("       -f or --force     force to overwrite outfile\n");
 	printf("       -t or --test      test compressed infile\n");
 	printf("       -b or --block <n> set block size in kb, default is 64\n");
+	printf("       -B or --min-block <n> adaptive block size from n kb up to block size\n");
 	printf("       -bc or --block-checksum include compressed block checksum\n");
+	printf("       -k or --checksum <name> checksum: adler32 (default), crc32c\n");
+	printf("           or xxh64 (64-bit, block checksum only, stream uses adler32)\n");
 	printf("       -v or --version   show library version\n");
 	printf("       -u or --unsafe    unsafe decompression\n");
 #if defined(MLZ_THREADS)
-	printf("       -T or --threads <n> set number of threads (1-%d)\n", (int)MLZ_MAX_THREADS);
+	printf("       -T or --threads <n> set number of threads\n");
+	printf("       -p or --pipeline  pipelined multi-threaded compression\n");
+	printf("           (compresses in background while reading/writing)\n");
+	printf("       -a or --async-read read infile in background when decompressing\n");
+	printf("           (unless memory-mapped, see -nm)\n");
+	printf("       -A or --affinity <cpus> pin worker threads to cpus, e.g. 0-7,16-23\n");
+	printf("       -L or --low-latency threads spin before sleeping (small blocks)\n");
 #endif
 	printf("       -i or --independent use independent blocks\n");
 	printf("           when using independent blocks, it's recommended\n");
 	printf("           to use block size of 128k or more\n");
+	printf("       -s or --sync <n>  reset context every n blocks (dependent blocks)\n");
+	printf("           allows multi-threaded decompression at a small ratio loss\n");
+	printf("       -x or --index     append block index (allows fast seeking)\n");
+	printf("       -z or --content-size store uncompressed size in header\n");
+	printf("       -o or --offset <n> decompress from uncompressed offset n\n");
+	printf("       -nm or --no-mmap  don't memory-map infile when decompressing\n");
+	printf("       -H or --huge-pages use huge pages for large buffers if possible\n");
 	printf("       -r or --raw       don't use stream header\n");
 	printf("       -rm or --raw-memory raw in memory compression\n");
+	printf("       -rp or --raw-parallel segmented raw in memory compression\n");
+	printf("           (independent segments are compressed and decompressed\n");
+	printf("           in parallel, see -T)\n");
 }
 
 #if defined(MLZ_THREADS)
@@ -186,8 +425,23 @@ static mlz_jobs jobs = MLZ_NULL;
 
 static void init_jobs(void)
 {
-	if (num_threads > 1)
-		jobs = mlz_jobs_create(num_threads-1);
+	mlz_jobs_options opts = mlz_default_jobs_options;
+
+	opts.allocator = allocator;
+
+	if (low_latency)
+		opts.spin_count = MLZ_JOBS_LOW_LATENCY_SPIN;
+
+	if (num_cpus) {
+		opts.cpus     = cpus;
+		opts.num_cpus = num_cpus;
+	}
+
+	/* in pipelined mode, this thread only does I/O */
+	if (compress && pipelined)
+		jobs = mlz_jobs_create_ex(num_threads, &opts);
+	else if (num_threads > 1)
+		jobs = mlz_jobs_create_ex(num_threads-1, &opts);
 }
 
 static void destroy_jobs(void)
@@ -217,6 +471,165 @@ static size_t read_little_dword(MLZ_CONST mlz_byte *buf)
 		((size_t)buf[2] << 16) | ((size_t)buf[3] << 24);
 }
 
+#if defined(MLZC_MMAP)
+
+typedef struct
+{
+	void   *data;
+	size_t  size;
+} mapped_file;
+
+/* maps regular file, returns MLZ_FALSE on failure */
+static mlz_bool map_file(FILE *f, mapped_file *mf)
+{
+#if defined(_WIN32)
+	HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+	HANDLE mapping;
+	LARGE_INTEGER fsize;
+
+	if (h == INVALID_HANDLE_VALUE || GetFileType(h) != FILE_TYPE_DISK || !GetFileSizeEx(h, &fsize))
+		return MLZ_FALSE;
+	if (fsize.QuadPart <= 0 || (unsigned __int64)fsize.QuadPart > (size_t)-1)
+		return MLZ_FALSE;
+
+	mapping = CreateFileMappingA(h, MLZ_NULL, PAGE_READONLY, 0, 0, MLZ_NULL);
+	if (!mapping)
+		return MLZ_FALSE;
+	mf->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	(void)CloseHandle(mapping);
+	mf->size = (size_t)fsize.QuadPart;
+	return mf->data != MLZ_NULL;
+#else
+	struct stat st;
+	int fd = fileno(f);
+
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return MLZ_FALSE;
+	if ((unsigned long long)st.st_size > (size_t)-1)
+		return MLZ_FALSE;
+
+	mf->size = (size_t)st.st_size;
+	mf->data = mmap(MLZ_NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mf->data == MAP_FAILED)
+		return MLZ_FALSE;
+#	if defined(MADV_SEQUENTIAL)
+	(void)madvise(mf->data, mf->size, MADV_SEQUENTIAL);
+#	endif
+	return MLZ_TRUE;
+#endif
+}
+
+static mlz_bool unmap_file(void *handle)
+{
+	mapped_file *mf = (mapped_file *)handle;
+#if defined(_WIN32)
+	return UnmapViewOfFile(mf->data) != 0;
+#else
+	return munmap(mf->data, mf->size) == 0;
+#endif
+}
+
+#if defined(MLZ_THREADS)
+/* uncompressed bytes decoded per batch of frames */
+#define MLZC_FRAME_BATCH (64 << 20)
+
+/* decode frame larger than batch buffer as stream, jobs split its blocks */
+static int frame_stream_decompress(MLZ_CONST mlz_stream_params *par, MLZ_CONST mlz_byte *data,
+	size_t size, mlz_byte *outbuf, FILE *fout)
+{
+	mlz_stream_params fpar = *par;
+	mlz_in_stream    *ins;
+	mlz_intptr        nread;
+	mlz_bool          ok;
+
+	fpar.multi_frame = MLZ_FALSE;
+	fpar.close_func  = MLZ_NULL;
+
+	ins = mlz_in_stream_open_memory(&fpar, data, size);
+	if (!ins) {
+		(void)fprintf(stderr, "failed to read in stream\n");
+		return 10;
+	}
+
+	while ((nread = mlz_stream_read(ins, outbuf, MLZC_FRAME_BATCH)) > 0) {
+		if (fout && fwrite(outbuf, (size_t)nread, 1, fout) != 1) {
+			(void)mlz_in_stream_close(ins);
+			(void)fprintf(stderr, "failed to write out file\n");
+			return 11;
+		}
+	}
+
+	ok = nread == 0 && mlz_in_stream_eof(ins);
+	if (!mlz_in_stream_close(ins) || !ok) {
+		(void)fprintf(stderr, "failed to read in stream\n");
+		return 10;
+	}
+
+	return 0;
+}
+
+/* decode concatenated streams in parallel, one frame per thread; */
+/* frames are decoded in batches of up to MLZC_FRAME_BATCH bytes  */
+static int frames_decompress(MLZ_CONST mlz_stream_params *par, MLZ_CONST mapped_file *mf, FILE *fout)
+{
+	MLZ_CONST mlz_byte *data = (MLZ_CONST mlz_byte *)mf->data;
+	mlz_byte  *outbuf;
+	size_t     pos = 0;
+	int        res = 0;
+
+	outbuf = (mlz_byte *)mlz_alloc(par->allocator, MLZC_FRAME_BATCH);
+	if (!outbuf)
+		return out_of_memory();
+
+	while (!res && pos < mf->size) {
+		mlz_ulong  usize = 0;
+		size_t     size  = 0;
+		mlz_intptr dlen;
+
+		/* gather frames while they fit, at least one */
+		do {
+			mlz_ulong fusize = 0;
+			size_t    fsize  = mlz_scan_frame(data + pos + size, mf->size - pos - size, &fusize);
+
+			if (!fsize) {
+				res = 10;
+				break;
+			}
+			if (size && usize + fusize > MLZC_FRAME_BATCH)
+				break;
+			size  += fsize;
+			usize += fusize;
+		} while (pos + size < mf->size);
+
+		if (res) {
+			(void)fprintf(stderr, "failed to read in stream\n");
+			break;
+		}
+
+		if (usize > MLZC_FRAME_BATCH) {
+			res = frame_stream_decompress(par, data + pos, size, outbuf, fout);
+			pos += size;
+			continue;
+		}
+
+		dlen = mlz_decompress_frames(par, data + pos, size, outbuf, MLZC_FRAME_BATCH);
+		if (dlen < 0) {
+			(void)fprintf(stderr, "failed to read in stream\n");
+			res = 10;
+		} else if (fout && dlen > 0 && fwrite(outbuf, (size_t)dlen, 1, fout) != 1) {
+			(void)fprintf(stderr, "failed to write out file\n");
+			res = 11;
+		}
+		pos += size;
+	}
+
+	mlz_dealloc(par->allocator, outbuf);
+	return res;
+}
+#endif
+
+#endif
+
 static int raw_mem_compress(FILE *fin, FILE *fout)
 {
 	size_t insz, outsz, compsz;
@@ -227,9 +640,7 @@ static int raw_mem_compress(FILE *fin, FILE *fout)
 	if (!fout)
 		return 0;
 
-	(void)fseek(fin, 0, SEEK_END);
-	insz = (size_t)ftell(fin);
-	(void)fseek(fin, 0, SEEK_SET);
+	insz = (size_t)file_size(fin);
 
 	inbuf = (mlz_byte *)mlz_malloc(insz);
 
@@ -278,9 +689,7 @@ static int raw_mem_decompress(FILE *fin, FILE *fout)
 	mlz_byte *outbuf;
 	mlz_uint checksum;
 
-	(void)fseek(fin, 0, SEEK_END);
-	insz = (size_t)ftell(fin);
-	(void)fseek(fin, 0, SEEK_SET);
+	insz = (size_t)file_size(fin);
 
 	inbuf = (mlz_byte *)mlz_malloc(insz);
 
@@ -330,6 +739,117 @@ static int raw_mem_decompress(FILE *fin, FILE *fout)
 	return 0;
 }
 
+/* read whole infile, returns MLZ_NULL on failure */
+static mlz_byte *read_infile(FILE *fin, size_t *size)
+{
+	mlz_byte *buf;
+
+	*size = (size_t)file_size(fin);
+
+	buf = (mlz_byte *)mlz_malloc(*size ? *size : 1);
+
+	if (buf && *size && fread(buf, *size, 1, fin) != 1) {
+		mlz_free(buf);
+		buf = MLZ_NULL;
+	}
+
+	return buf;
+}
+
+static int raw_par_compress(FILE *fin, FILE *fout)
+{
+	size_t insz, outsz, compsz;
+	mlz_byte *inbuf;
+	mlz_byte *outbuf;
+
+	inbuf = read_infile(fin, &insz);
+
+	if (!inbuf) {
+		(void)fprintf(stderr, "failed to read input file\n");
+		return 10;
+	}
+
+	outsz  = mlz_compress_parallel_bound(insz);
+	outbuf = (mlz_byte *)mlz_alloc(allocator, outsz);
+
+	if (!outbuf) {
+		mlz_free(inbuf);
+		return out_of_memory();
+	}
+
+	/* independent segments (as mlz_compress_parallel), decompress in parallel */
+#if defined(MLZ_THREADS)
+	compsz = mlz_compress_parallel_ex(outbuf, outsz, inbuf, insz, level, jobs, 0, allocator);
+#else
+	compsz = mlz_compress_parallel_ex(outbuf, outsz, inbuf, insz, level, MLZ_NULL, 0, allocator);
+#endif
+
+	if (!compsz) {
+		mlz_free(inbuf);
+		mlz_dealloc(allocator, outbuf);
+		(void)fprintf(stderr, "compression failed\n");
+		return 8;
+	}
+
+	if (fwrite(outbuf, compsz, 1, fout) != 1) {
+		mlz_free(inbuf);
+		mlz_dealloc(allocator, outbuf);
+		(void)fprintf(stderr, "failed to write output file\n");
+		return 7;
+	}
+
+	mlz_free(inbuf);
+	mlz_dealloc(allocator, outbuf);
+	return 0;
+}
+
+static int raw_par_decompress(FILE *fin, FILE *fout)
+{
+	size_t insz, outsz;
+	mlz_byte *inbuf;
+	mlz_byte *outbuf;
+
+	inbuf = read_infile(fin, &insz);
+
+	if (!inbuf || mlz_decompress_parallel_size(inbuf, insz) < 0) {
+		if (inbuf)
+			mlz_free(inbuf);
+		(void)fprintf(stderr, "failed to read input file\n");
+		return 10;
+	}
+
+	outsz  = (size_t)mlz_decompress_parallel_size(inbuf, insz);
+	outbuf = (mlz_byte *)mlz_alloc(allocator, outsz ? outsz : 1);
+
+	if (!outbuf) {
+		mlz_free(inbuf);
+		return out_of_memory();
+	}
+
+	/* also verifies checksum */
+#if defined(MLZ_THREADS)
+	if (mlz_decompress_parallel_ex(outbuf, outsz, inbuf, insz, jobs, allocator) < 0) {
+#else
+	if (mlz_decompress_parallel_ex(outbuf, outsz, inbuf, insz, MLZ_NULL, allocator) < 0) {
+#endif
+		mlz_free(inbuf);
+		mlz_dealloc(allocator, outbuf);
+		(void)fprintf(stderr, "failed to decompress input file\n");
+		return 10;
+	}
+
+	if (fout && outsz && fwrite(outbuf, outsz, 1, fout) != 1) {
+		mlz_free(inbuf);
+		mlz_dealloc(allocator, outbuf);
+		(void)fprintf(stderr, "failed to write output file\n");
+		return 7;
+	}
+
+	mlz_free(inbuf);
+	mlz_dealloc(allocator, outbuf);
+	return 0;
+}
+
 static int process(void)
 {
 	FILE *fin, *fout = MLZ_NULL;
@@ -366,8 +886,8 @@ static int process(void)
 		mlz_out_stream   *outs;
 		mlz_stream_params par  = mlz_default_stream_params;
 
-		if (raw_mem) {
-			int res = raw_mem_compress(fin, fout);
+		if (raw_mem || raw_par) {
+			int res = raw_par ? raw_par_compress(fin, fout) : raw_mem_compress(fin, fout);
 			MLZ_ASSERT(fout);
 			(void)fclose(fout);
 			(void)fclose(fin);
@@ -377,12 +897,18 @@ static int process(void)
 		par.handle             = fout;
 		par.independent_blocks = independent;
 		par.block_size         = block_size;
+		par.min_block_size     = min_block_size;
+		par.sync_interval      = sync_interval;
+		par.use_index          = use_index;
 		par.close_func         = MLZ_NULL;
+		par.allocator          = allocator;
+		if (content_size)
+			par.content_size = file_size(fin);
 #if defined(MLZ_THREADS)
 		par.jobs               = jobs;
+		par.pipelined          = pipelined;
 #endif
-		if (block_checksum)
-			par.block_checksum = mlz_adler32_simple;
+		set_checksum(&par);
 		if (raw)
 			par.use_header = MLZ_FALSE;
 
@@ -395,10 +921,18 @@ static int process(void)
 			return 6;
 		}
 		for (;;) {
-			size_t nread = fread(buffer, 1, sizeof(buffer), fin);
-			if (!nread)
+			/* read directly into stream staging buffer to avoid extra copy */
+			void      *ptr;
+			mlz_intptr avail;
+			size_t     nread = 0;
+			mlz_bool   res   = mlz_out_stream_acquire(outs, &ptr, &avail);
+			if (res) {
+				nread = fread(ptr, 1, (size_t)avail, fin);
+				res = mlz_out_stream_commit(outs, (mlz_intptr)nread);
+			}
+			if (res && !nread)
 				break;
-			if (mlz_stream_write(outs, buffer, nread) != (mlz_intptr)nread) {
+			if (!res) {
 				(void)mlz_out_stream_close(outs);
 				(void)fclose(fin);
 				if (fout)
@@ -418,9 +952,12 @@ static int process(void)
 		/* decompress */
 		mlz_in_stream    *ins;
 		mlz_stream_params par  = mlz_default_stream_params;
+#if defined(MLZC_MMAP)
+		mapped_file       mf;
+#endif
 
-		if (raw_mem) {
-			int res = raw_mem_decompress(fin, fout);
+		if (raw_mem || raw_par) {
+			int res = raw_par ? raw_par_decompress(fin, fout) : raw_mem_decompress(fin, fout);
 			if (fout)
 				(void)fclose(fout);
 			(void)fclose(fin);
@@ -432,14 +969,39 @@ static int process(void)
 		par.block_size         = block_size;
 		par.unsafe             = unsafe;
 		par.close_func         = MLZ_NULL;
-		if (block_checksum)
-			par.block_checksum = mlz_adler32_simple;
+		par.allocator          = allocator;
+		/* decode concatenated streams */
+		par.multi_frame        = MLZ_TRUE;
+		/* stream runs to end of file */
+		par.read_ahead         = 65536;
+		set_checksum(&par);
 		if (raw)
 			par.use_header     = MLZ_FALSE;
 #if defined(MLZ_THREADS)
 		par.jobs               = jobs;
+		par.async_read         = async_read;
 #endif
 
+#if defined(MLZC_MMAP)
+		if (use_mmap && map_file(fin, &mf)) {
+#if defined(MLZ_THREADS)
+			if (jobs && offset <= 0 && !raw && mlz_scan_frames(mf.data, mf.size, MLZ_NULL) > 1) {
+				int res = frames_decompress(&par, &mf, test ? MLZ_NULL : fout);
+				(void)unmap_file(&mf);
+				if (fout)
+					(void)fclose(fout);
+				(void)fclose(fin);
+				return res;
+			}
+#endif
+			/* stream unmaps on close */
+			par.handle     = &mf;
+			par.close_func = unmap_file;
+			ins = mlz_in_stream_open_memory(&par, mf.data, mf.size);
+			if (!ins)
+				(void)unmap_file(&mf);
+		} else
+#endif
 		ins = mlz_in_stream_open(&par);
 		if (!ins) {
 			(void)fclose(fin);
@@ -448,9 +1010,19 @@ static int process(void)
 			(void)fprintf(stderr, "couldn't create/open in stream\n");
 			return 9;
 		}
+		if (offset > 0 && !mlz_in_stream_seek(ins, (mlz_ulong)offset)) {
+			(void)mlz_in_stream_close(ins);
+			(void)fclose(fin);
+			if (fout)
+				(void)fclose(fout);
+			(void)fprintf(stderr, "failed to seek in stream\n");
+			return 13;
+		}
 		for (;;) {
-			mlz_intptr nread = mlz_stream_read(ins, buffer, sizeof(buffer));
-			if (nread < 0) {
+			/* write decoded data directly from stream buffer to avoid extra copy */
+			MLZ_CONST void *ptr;
+			mlz_intptr      nread;
+			if (!mlz_in_stream_peek(ins, &ptr, &nread) || !mlz_in_stream_consume(ins, nread)) {
 				(void)mlz_in_stream_close(ins);
 				(void)fclose(fin);
 				if (fout)
@@ -460,7 +1032,7 @@ static int process(void)
 			}
 			if (!nread)
 				break;
-			if (!test && fout && (mlz_intptr)fwrite(buffer, 1, nread, fout) != nread) {
+			if (!test && fout && (mlz_intptr)fwrite(ptr, 1, nread, fout) != nread) {
 				(void)mlz_in_stream_close(ins);
 				(void)fclose(fin);
 				if (fout)